@@ -20,6 +20,41 @@
       Inclination mapped to the output value
  **************************************************************/
 
+
+
+/*************************** NOTES ***************************
+  Two output modes:
+  - ASCII (at boot): one "G+57" / "B-12" line per loop for the dominant
+    axis, mapped to 0..100. Kept for older hosts.
+  - BINARY: enabled by the host with a CONFIGURE command, which also sets
+    the baud rate and the packet rate (500 to 1000 Hz). Every packet period
+    the three axes are read OVERSAMPLING times and averaged.
+
+  Packet, STREAM_PACKET_SIZE bytes, little endian:
+    0-1    sync 0xA5 0x5A
+    2      type: PACKET_SAMPLE or PACKET_ACK
+    3      flags: bit 0 = finger pinched, bit 1 = CONFIRM received
+    4-5    sequence number (wraps)
+    6-11   x, y, z: int16 distance from the rest position, in ADC steps
+    12-13  packet rate in Hz
+    14-15  CRC-16/CCITT-FALSE of bytes 2-13
+  An ACK carries the accepted baud rate (uint32) in bytes 6-9.
+
+  Command from the host:
+    '*' '~' command size payload[size] crc16(command, size, payload)
+  CONFIGURE payload: uint32 baud rate, uint16 packet rate in Hz.
+  CONFIRM: no payload, sent by the host at the new rate every 100 ms.
+
+  The ACK goes out at the old rate, then both sides switch. If no CONFIRM
+  arrives for CONFIRM_TIMEOUT ms, because the ACK or the CONFIRMs were
+  lost or the host went away, the board goes back to BOOT_BAUD and ASCII,
+  where the host falls back too once it stops getting confirmed packets.
+
+  Keep these values in sync with Source/SerialDevice.cpp.
+  The MKR's Serial is native USB, where the baud rate has no effect. The
+  negotiation matters for boards behind a USB-UART bridge.
+ **************************************************************/
+
 #include <math.h>
 
 
@@ -48,6 +83,29 @@
 #define Z_THRES 50
 #define MAP_SIZE 100
 
+// BINARY STREAMING
+#define BOOT_BAUD 250000
+#define OVERSAMPLING 4
+#define MIN_RATE_HZ 500
+#define MAX_RATE_HZ 1000
+
+#define PACKET_SYNC1 0xA5
+#define PACKET_SYNC2 0x5A
+#define PACKET_SAMPLE 0x01
+#define PACKET_ACK 0x02
+#define PACKET_FLAG_PINCH 0x01
+#define PACKET_FLAG_CONFIRMED 0x02
+#define STREAM_PACKET_SIZE 16
+
+#define COMMAND_START1 '*'
+#define COMMAND_START2 '~'
+#define COMMAND_CONFIGURE 0x10
+#define COMMAND_CONFIRM 0x11
+#define CONFIRM_TIMEOUT 500  // ms
+#define COMMAND_MAX_PAYLOAD 8
+
+const uint32_t SUPPORTED_BAUDS[] = { 115200, 230400, 250000, 460800, 500000, 921600, 1000000, 2000000 };
+
 // Accelerometer values at rest from datasheet, to be overwritten by the calibration routine
 uint16_t xRest = 338;
 uint16_t yRest = 338;
@@ -69,9 +127,22 @@ float value_map[MAP_SIZE][2] = {
 uint8_t knobX = 1, knobY = 1;  // which knob is active
 int16_t fixed_value_x=0, fixed_value_y=0;
 
+// Binary streaming state
+bool streaming = false;
+bool confirmed = false;
+uint32_t lastConfirmTime = 0;  // ms
+uint32_t currentBaud = BOOT_BAUD;
+uint16_t streamRateHz = MAX_RATE_HZ;
+uint32_t packetPeriod = 1000000UL / MAX_RATE_HZ;  // us
+uint32_t nextPacketTime = 0;                       // us
+uint16_t sequence = 0;
+int32_t axisSums[3];
+uint8_t axisCount = 0;
+
 void setup() {
 
-  Serial.begin(250000);
+  Serial.begin(BOOT_BAUD);
+  configureFastAdc();
 
   pinMode(A6, INPUT_PULLUP);
 
@@ -95,6 +166,16 @@ void setup() {
 
 void loop() {
 
+  readCommands();
+
+  if (streaming && millis() - lastConfirmTime > CONFIRM_TIMEOUT)
+    stopStreaming();
+
+  if (streaming) {
+    streamSamples();
+    return;
+  }
+
   readAxis(WINDOW_SAMPLES);
 
   detectRotation();
@@ -102,6 +183,173 @@ void loop() {
   sendMessage();
 }
 
+
+// The default core settings take about 400 us per conversion, too slow for
+// 3 axes x OVERSAMPLING reads per millisecond. Same 10-bit result, ~10 us.
+void configureFastAdc() {
+#if defined(ARDUINO_ARCH_SAMD)
+  ADC->CTRLA.bit.ENABLE = 0;
+  while (ADC->STATUS.bit.SYNCBUSY);
+  ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV32 | ADC_CTRLB_RESSEL_10BIT;
+  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_1 | ADC_AVGCTRL_ADJRES(0);
+  ADC->SAMPCTRL.reg = 5;
+  while (ADC->STATUS.bit.SYNCBUSY);
+  ADC->CTRLA.bit.ENABLE = 1;
+  while (ADC->STATUS.bit.SYNCBUSY);
+#endif
+}
+
+
+// Takes the OVERSAMPLING reads of a packet spread over its period, then
+// sends their average. If the loop fell behind, the schedule restarts
+// from now instead of sending a burst of late packets.
+void streamSamples() {
+  const uint32_t now = micros();
+  const uint32_t packetStart = nextPacketTime - packetPeriod;
+
+  if (axisCount < OVERSAMPLING && (int32_t)(now - (packetStart + axisCount * (packetPeriod / OVERSAMPLING))) >= 0) {
+    for (int i = 0; i < 3; i++)
+      axisSums[i] += analogRead(PINS[i]);
+    axisCount++;
+  }
+
+  if ((int32_t)(now - nextPacketTime) < 0 || axisCount == 0)
+    return;
+
+  const int16_t x = axisSums[0] / axisCount - xRest;
+  const int16_t y = axisSums[1] / axisCount - yRest;
+  const int16_t z = axisSums[2] / axisCount - zRest;
+  const uint8_t flags = (!digitalRead(FINGER_PIN) ? PACKET_FLAG_PINCH : 0) | (confirmed ? PACKET_FLAG_CONFIRMED : 0);
+  sendPacket(PACKET_SAMPLE, flags, x, y, z, 0);
+
+  axisSums[0] = axisSums[1] = axisSums[2] = 0;
+  axisCount = 0;
+  nextPacketTime += packetPeriod;
+  if ((int32_t)(now - nextPacketTime) >= 0)
+    nextPacketTime = now + packetPeriod;
+}
+
+void sendPacket(uint8_t type, uint8_t flags, int16_t x, int16_t y, int16_t z, uint32_t baud) {
+  uint8_t packet[STREAM_PACKET_SIZE];
+  packet[0] = PACKET_SYNC1;
+  packet[1] = PACKET_SYNC2;
+  packet[2] = type;
+  packet[3] = flags;
+  writeUint16(packet + 4, sequence++);
+  if (type == PACKET_ACK) {
+    writeUint16(packet + 6, baud & 0xFFFF);
+    writeUint16(packet + 8, baud >> 16);
+    writeUint16(packet + 10, 0);
+  } else {
+    writeUint16(packet + 6, x);
+    writeUint16(packet + 8, y);
+    writeUint16(packet + 10, z);
+  }
+  writeUint16(packet + 12, streamRateHz);
+  writeUint16(packet + 14, crc16(packet + 2, 12));
+  Serial.write(packet, STREAM_PACKET_SIZE);
+}
+
+void writeUint16(uint8_t* data, uint16_t value) {
+  data[0] = value & 0xFF;
+  data[1] = value >> 8;
+}
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+uint16_t crc16(const uint8_t* data, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Collects the command frames sent by the host
+void readCommands() {
+  static uint8_t frame[4 + COMMAND_MAX_PAYLOAD + 2];
+  static uint8_t length = 0;
+
+  while (Serial.available() > 0) {
+    const uint8_t data = Serial.read();
+
+    if (length == 0 && data != COMMAND_START1)
+      continue;
+    if (length == 1 && data != COMMAND_START2) {
+      length = (data == COMMAND_START1) ? 1 : 0;
+      continue;
+    }
+    frame[length++] = data;
+
+    if (length < 4)
+      continue;
+    const uint8_t size = frame[3];
+    if (size > COMMAND_MAX_PAYLOAD) {
+      length = 0;
+      continue;
+    }
+    if (length == 4 + size + 2) {
+      const uint16_t crc = frame[4 + size] | (frame[5 + size] << 8);
+      if (crc == crc16(frame + 2, 2 + size))
+        executeCommand(frame[2], frame + 4, size);
+      length = 0;
+    }
+  }
+}
+
+void executeCommand(uint8_t command, const uint8_t* payload, uint8_t size) {
+  if (command == COMMAND_CONFIRM && size == 0 && streaming) {
+    confirmed = true;
+    lastConfirmTime = millis();
+    return;
+  }
+  if (command != COMMAND_CONFIGURE || size != 6)
+    return;
+
+  const uint32_t baud = (uint32_t)payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+  const uint16_t rate = payload[4] | (payload[5] << 8);
+
+  uint32_t newBaud = currentBaud;
+  for (uint8_t i = 0; i < sizeof(SUPPORTED_BAUDS) / sizeof(SUPPORTED_BAUDS[0]); i++)
+    if (SUPPORTED_BAUDS[i] == baud)
+      newBaud = baud;
+
+  streamRateHz = constrain(rate, MIN_RATE_HZ, MAX_RATE_HZ);
+  packetPeriod = 1000000UL / streamRateHz;
+
+  // The ACK goes out at the old rate, then both sides switch
+  sequence = 0;
+  sendPacket(PACKET_ACK, 0, 0, 0, 0, newBaud);
+  Serial.flush();
+  if (newBaud != currentBaud) {
+    delay(5);
+    Serial.end();
+    Serial.begin(newBaud);
+    currentBaud = newBaud;
+  }
+
+  streaming = true;
+  confirmed = false;
+  lastConfirmTime = millis();
+  axisSums[0] = axisSums[1] = axisSums[2] = 0;
+  axisCount = 0;
+  nextPacketTime = micros() + packetPeriod;
+}
+
+// Back to the boot rate and the ASCII lines, which the host reads without
+// any negotiation
+void stopStreaming() {
+  Serial.flush();
+  if (currentBaud != BOOT_BAUD) {
+    Serial.end();
+    Serial.begin(BOOT_BAUD);
+    currentBaud = BOOT_BAUD;
+  }
+  streaming = false;
+  confirmed = false;
+}
+
 int16_t readMap(int16_t delta) {
 
   uint8_t min_index = 0, max_index = 0;
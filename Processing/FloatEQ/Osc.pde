@@ -1,16 +1,72 @@
 import oscP5.*;
 import netP5.*;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 // Global variables
 OscP5 oscP5;
 NetAddress myRemoteLocation;
 
+// Last quantized value of each band and last frame received for each channel, used to undo delta encoding
+int[][] previousSteps = { new int[0], new int[0] };
+long[] lastFrameCounter = { -1, -1 };
+
 // OSC event handler
 void oscEvent(OscMessage message) {
   if(message.addrPattern().equals("/spectrum")){
+    // The last argument is the ID of the plugin instance that sent the spectrum
+    int instanceId = message.get(message.arguments().length - 1).intValue();
+    if (instanceId != displayedInstance) {
+      return;
+    }
     for (int i = 0; i < nBeans; i++) {
       float value = clamp(message.get(i).floatValue() * 0.01, 0f, 1f);
       currentValues.set(i, value);
     }
   }
+  if(message.addrPattern().equals("/spectrum/blob")){
+    decodeSpectrumBlob(message.get(0).blobValue());
+  }
+}
+
+// Decodes the quantized spectrum sent by the plugin, see Source/OscManager.h for the layout
+void decodeSpectrumBlob(byte[] blob) {
+  ByteBuffer buffer = ByteBuffer.wrap(blob).order(ByteOrder.LITTLE_ENDIAN);
+  if (blob.length < 28 || buffer.get(0) != 'F' || buffer.get(1) != 'F' || buffer.get(2) != 'X' || buffer.get(3) != 'S') {
+    return;
+  }
+  int bitsPerBand = buffer.get(5) & 0xFF;
+  boolean isDelta = (buffer.get(6) & 1) != 0;
+  int channel = buffer.get(7) & 0xFF;
+  long frameCounter = buffer.getInt(8) & 0xFFFFFFFFL;
+  int numBands = buffer.getShort(12) & 0xFFFF;
+  int instanceId = buffer.getShort(14) & 0xFFFF;
+  float minDb = buffer.getFloat(20);
+  float dbPerStep = buffer.getFloat(24);
+  int maxStep = (1 << bitsPerBand) - 1;
+
+  if (channel >= previousSteps.length || instanceId != displayedInstance) {
+    return;
+  }
+  if (previousSteps[channel].length != numBands) {
+    previousSteps[channel] = new int[numBands];
+    lastFrameCounter[channel] = -1;
+  }
+  // A delta frame is useless if the frame before it was lost: wait for the next key frame
+  if (isDelta && frameCounter != ((lastFrameCounter[channel] + 1) & 0xFFFFFFFFL)) {
+    lastFrameCounter[channel] = -1;
+    return;
+  }
+  lastFrameCounter[channel] = frameCounter;
+
+  for (int i = 0; i < numBands; i++) {
+    int value = bitsPerBand == 8 ? (buffer.get(28 + i) & 0xFF) : (buffer.getShort(28 + 2 * i) & 0xFFFF);
+    int step = isDelta ? ((previousSteps[channel][i] + value) & maxStep) : value;
+    previousSteps[channel][i] = step;
+
+    if (i < nBeans && channel == displayedChannel) {
+      float magnitude = (float)Math.pow(10, (minDb + step * dbPerStep) / 20.0);
+      currentValues.set(i, clamp(magnitude * 0.01, 0f, 1f));
+    }
+  }
 }
@@ -18,3 +18,5 @@ color barColor = color(80, 50, 179);
 // OSC
 String ip = "127.0.0.1";
 int port = 7771;
+int displayedChannel = 0; // 1 shows the right channel when the plugin analyses in stereo
+int displayedInstance = 0; // ID of the plugin instance to show, when several are loaded
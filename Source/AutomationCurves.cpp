@@ -0,0 +1,105 @@
+/*
+* Implementation of AutomationCurves.h
+*/
+
+#include "AutomationCurves.h"
+
+juce::Result AutomationCurves::loadFromJson(const juce::File& file)
+{
+    juce::var json;
+    const juce::Result parsed = juce::JSON::parse(file.loadFileAsString(), json);
+    if (parsed.failed())
+        return juce::Result::fail(file.getFileName() + ": " + parsed.getErrorMessage());
+
+    auto* object = json.getDynamicObject();
+    if (object == nullptr)
+        return juce::Result::fail(file.getFileName() + ": expected an object of parameter curves");
+
+    for (const auto& property : object->getProperties()) {
+        const juce::Array<juce::var>* points = property.value.getArray();
+        if (points == nullptr)
+            return juce::Result::fail(file.getFileName() + ": curve " + property.name.toString() + " is not an array");
+
+        auto& curve = curves[property.name.toString()];
+        for (const auto& point : *points) {
+            if (!point.isArray() || point.size() != 2)
+                return juce::Result::fail(file.getFileName() + ": points of " + property.name.toString() + " must be [time, value]");
+            curve.push_back({ static_cast<double>(point[0]), static_cast<float>(point[1]) });
+        }
+    }
+
+    sortPoints();
+    return juce::Result::ok();
+}
+
+juce::Result AutomationCurves::loadFromGestureLog(const juce::File& file)
+{
+    juce::StringArray lines;
+    file.readLines(lines);
+
+    for (int i = 0; i < lines.size(); ++i) {
+        const juce::String line = lines[i].trim();
+        if (line.isEmpty() || line.startsWithChar('#'))
+            continue;
+
+        const juce::StringArray fields = juce::StringArray::fromTokens(line, ",", "");
+        if (fields.size() != 3)
+            return juce::Result::fail(file.getFileName() + ":" + juce::String(i + 1) + ": expected seconds,parameterID,value");
+
+        curves[fields[1].trim()].push_back({ fields[0].getDoubleValue(), fields[2].getFloatValue() });
+    }
+
+    sortPoints();
+    return juce::Result::ok();
+}
+
+void AutomationCurves::addPoint(const juce::String& parameterID, double timeSeconds, float value)
+{
+    curves[parameterID].push_back({ timeSeconds, value });
+    sortPoints();
+}
+
+void AutomationCurves::sortPoints()
+{
+    for (auto& curve : curves) {
+        std::stable_sort(curve.second.begin(), curve.second.end(),
+            [](const Point& a, const Point& b) { return a.time < b.time; });
+    }
+}
+
+float AutomationCurves::valueAt(const std::vector<Point>& points, double timeSeconds)
+{
+    if (timeSeconds <= points.front().time)
+        return points.front().value;
+    if (timeSeconds >= points.back().time)
+        return points.back().value;
+
+    const auto next = std::upper_bound(points.begin(), points.end(), timeSeconds,
+        [](double t, const Point& p) { return t < p.time; });
+    const auto previous = next - 1;
+
+    const double alpha = (timeSeconds - previous->time) / (next->time - previous->time);
+    return static_cast<float>(previous->value + alpha * (next->value - previous->value));
+}
+
+void AutomationCurves::apply(juce::AudioProcessor& processor, double timeSeconds) const
+{
+    for (auto* parameter : processor.getParameters()) {
+        auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter);
+        if (ranged == nullptr)
+            continue;
+
+        const auto curve = curves.find(ranged->getParameterID());
+        if (curve == curves.end() || curve->second.empty())
+            continue;
+
+        // setValue() alone would not reach the listener that updates the raw value of the
+        // AudioProcessorValueTreeState, which is what processBlock reads
+        const float value = ranged->convertTo0to1(valueAt(curve->second, timeSeconds));
+        if (value != ranged->getValue()) {
+            ranged->beginChangeGesture();
+            ranged->setValueNotifyingHost(value);
+            ranged->endChangeGesture();
+        }
+    }
+}
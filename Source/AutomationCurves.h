@@ -0,0 +1,44 @@
+/*
+  Parameter automation used by the offline renderer. Each curve is a list of
+  (time, value) points for one parameter ID, interpolated linearly and held
+  before the first and after the last point. Values are in the parameter's
+  own range (e.g. Hz for EQcutoff), not normalised.
+
+  Curves can be loaded from:
+  - a JSON file: { "EQcutoff": [[0.0, 500], [4.0, 8000]], "drive": [[0.0, 10]] }
+  - a gesture log: one "seconds,parameterID,value" line per recorded change,
+    lines starting with '#' are ignored
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <map>
+#include <vector>
+
+class AutomationCurves
+{
+public:
+    juce::Result loadFromJson(const juce::File& file);
+    juce::Result loadFromGestureLog(const juce::File& file);
+
+    // Adds one point to the curve of a parameter, in the parameter's range
+    void addPoint(const juce::String& parameterID, double timeSeconds, float value);
+
+    bool isEmpty() const { return curves.empty(); }
+
+    // Sets every automated parameter of the processor to its value at timeSeconds,
+    // notifying its listeners so the parameter trees pick up the new value.
+    void apply(juce::AudioProcessor& processor, double timeSeconds) const;
+
+private:
+    struct Point {
+        double time;
+        float value;
+    };
+
+    static float valueAt(const std::vector<Point>& points, double timeSeconds);
+    void sortPoints();
+
+    std::map<juce::String, std::vector<Point>> curves;
+};
@@ -0,0 +1,93 @@
+/*
+  A cascade of biquad sections in transposed direct form II, run over the groups of an
+  InterleavedBlock: every section processes all the channels of a group at once, one SIMD
+  lane per channel. All the sections are applied to a sample before moving to the next
+  one, so the filter states stay in registers and the block is read and written only once,
+  instead of once per filter as with a chain of IIR::Filter.
+
+  Sections are addressed by slot. Only the enabled slots are run, and a slot keeps its
+  state while its coefficients change, so the parameters can move without clicks.
+*/
+
+#pragma once
+
+#include "InterleavedBlock.h"
+
+template <int maxSections>
+class BiquadCascade
+{
+public:
+    using Register = InterleavedBlock::Register;
+
+    void prepare(int numGroups)
+    {
+        states.assign(static_cast<size_t>(numGroups), {});
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto& groupState : states)
+            for (auto& state : groupState)
+                state = { Register::expand(0.0f), Register::expand(0.0f) };
+    }
+
+    // Coefficients as {b0, b1, b2, a0, a1, a2}, as returned by IIR::ArrayCoefficients
+    void setSection(int slot, const std::array<float, 6>& coefficients)
+    {
+        const float a0 = coefficients[3];
+        sections[slot] = { Register::expand(coefficients[0] / a0), Register::expand(coefficients[1] / a0),
+                           Register::expand(coefficients[2] / a0), Register::expand(coefficients[4] / a0),
+                           Register::expand(coefficients[5] / a0) };
+    }
+
+    void setEnabled(int slot, bool shouldBeEnabled)
+    {
+        if (enabled[slot] == shouldBeEnabled)
+            return;
+
+        enabled[slot] = shouldBeEnabled;
+
+        // A section coming back starts from silence rather than from its old state
+        if (shouldBeEnabled)
+            for (auto& groupState : states)
+                groupState[slot] = { Register::expand(0.0f), Register::expand(0.0f) };
+
+        numActive = 0;
+        for (int s = 0; s < maxSections; ++s)
+            if (enabled[s])
+                active[numActive++] = s;
+    }
+
+    int getNumActiveSections() const { return numActive; }
+
+    void process(int group, Register* samples, int numSamples)
+    {
+        auto& groupState = states[static_cast<size_t>(group)];
+
+        for (int i = 0; i < numSamples; ++i) {
+            Register x = samples[i];
+            for (int n = 0; n < numActive; ++n) {
+                const int s = active[n];
+                const auto& c = sections[s];
+                auto& state = groupState[s];
+                const Register y = c.b0 * x + state.s1;
+                state.s1 = c.b1 * x - c.a1 * y + state.s2;
+                state.s2 = c.b2 * x - c.a2 * y;
+                x = y;
+            }
+            samples[i] = x;
+        }
+    }
+
+private:
+    struct Section { Register b0, b1, b2, a1, a2; };
+    struct State { Register s1, s2; };
+
+    std::array<Section, maxSections> sections;
+    std::vector<std::array<State, maxSections>> states;
+
+    std::array<bool, maxSections> enabled{};
+    std::array<int, maxSections> active{};
+    int numActive = 0;
+};
@@ -0,0 +1,174 @@
+/*
+* Implementation of DeviceHub.h
+*/
+
+#include "DeviceHub.h"
+
+// Comma separated serial ports, in controller ID order, replacing the detected ones
+const char* const kSerialPortsVariable{ "FLOATFX_SERIAL_PORTS" };
+
+// Names of the USB serial ports of the boards on macOS and Linux. Other ports, like
+// Bluetooth or the built-in ones, are left alone. Windows only has "COMn" names.
+const juce::StringArray kUsbSerialPatterns{ "*usbmodem*", "*usbserial*", "*ttyACM*", "*ttyUSB*" };
+
+// One port per controller, the index is the controller ID
+static juce::StringArray findSerialPorts()
+{
+    const auto configured = juce::SystemStats::getEnvironmentVariable(kSerialPortsVariable, {});
+    if (configured.isNotEmpty()) {
+        auto ports = juce::StringArray::fromTokens(configured, ",", "");
+        ports.trim();
+        ports.removeEmptyStrings();
+#if JUCE_WINDOWS
+        // COM10 and above can only be opened by their device path
+        for (auto& port : ports)
+            if (port.startsWithIgnoreCase("COM"))
+                port = "\\\\.\\" + port;
+#endif
+        return ports;
+    }
+
+    juce::StringArray ports;
+    for (const auto& path : SerialPort::getSerialPortPaths().getAllValues()) {
+#if JUCE_WINDOWS
+        ports.addIfNotAlreadyThere(path);
+#else
+        for (const auto& pattern : kUsbSerialPatterns)
+            if (path.matchesWildcard(pattern, true)) {
+                ports.addIfNotAlreadyThere(path);
+                break;
+            }
+#endif
+    }
+    // Same order every time for the same boards, COM3 before COM10
+    ports.sortNatural();
+    return ports;
+}
+
+DeviceHub::DeviceHub()
+    : serialDevice([this](const Message& message) { pushMessage(message); }),
+      gestureReceiver([this](const Message& message) { pushMessage(message); })
+{
+}
+
+DeviceHub::~DeviceHub()
+{
+    // serialDevice and gestureReceiver are declared after the queues, so their
+    // threads are stopped before the queues they write to are destroyed.
+}
+
+void DeviceHub::start()
+{
+    std::call_once(startFlag, [this] {
+        serialDevice.init(findSerialPorts());
+        gestureReceiver.connect(gesturePort);
+        if (oscSocket.bindToPort(0))
+            oscSender.connectToSocket(oscSocket, ip, port);
+        started = true;
+    });
+}
+
+int DeviceHub::addInstance()
+{
+    for (int id = 0; id < maxInstances; ++id) {
+        bool expected = false;
+        if (queues[id].active.compare_exchange_strong(expected, true)) {
+            // Drop whatever was left by the previous owner of this slot.
+            Message message;
+            for (int controller = 0; controller < maxControllers; ++controller)
+                while (popMessage(id, controller, message)) {}
+            return id;
+        }
+    }
+    return -1;
+}
+
+void DeviceHub::removeInstance(int instanceId)
+{
+    if (instanceId >= 0 && instanceId < maxInstances)
+        queues[instanceId].active = false;
+}
+
+bool DeviceHub::popMessage(int instanceId, int controller, Message& message)
+{
+    if (instanceId < 0 || instanceId >= maxInstances || controller < 0 || controller >= maxControllers)
+        return false;
+
+    auto& queue = queues[instanceId].controllers[controller];
+    const auto scope = queue.fifo.read(1);
+    if (scope.blockSize1 > 0) {
+        message = queue.messages[scope.startIndex1];
+        return true;
+    }
+    return false;
+}
+
+void DeviceHub::pushMessage(const Message& message)
+{
+    if (message.controller < 0 || message.controller >= maxControllers)
+        return;
+
+    const juce::SpinLock::ScopedLockType lock(pushLock);
+
+    // The value every instance gets, projected forward when prediction is on
+    Message predicted = message;
+    const int axis = axisIndex(message.direction);
+    if (axis >= 0) {
+        const float latency = gestureLatencyMs;
+        const float value = message.verse == MINUS_SIGN ? -float(message.value) : float(message.value);
+        const float output = predictors[message.controller][axis].process(value, message.time, predictionMode,
+            latency * predictionAggressiveness, latency, predictionErrors[message.controller]);
+        predicted.verse = output < 0.0f ? MINUS_SIGN : PLUS_SIGN;
+        predicted.value = juce::roundToInt(std::abs(output));
+    }
+
+    for (auto& instance : queues) {
+        if (!instance.active.load())
+            continue;
+
+        auto& queue = instance.controllers[message.controller];
+
+        // If an instance doesn't read its messages (e.g. its editor is closed)
+        // the queue fills up and the new messages are dropped.
+        const auto scope = queue.fifo.write(1);
+        if (scope.blockSize1 > 0)
+            queue.messages[scope.startIndex1] = predicted;
+    }
+}
+
+void DeviceHub::setPrediction(PredictionMode mode, float aggressiveness)
+{
+    predictionAggressiveness = juce::jlimit(0.0f, 1.5f, aggressiveness);
+    if (mode != predictionMode.exchange(mode))
+        for (auto& errors : predictionErrors)
+            errors.reset();
+}
+
+void DeviceHub::reportGestureLatency(float latencyMs)
+{
+    // Smoothed over a second or so of editor timer ticks
+    const float previous = gestureLatencyMs;
+    gestureLatencyMs = previous > 0.0f ? previous + 0.05f * (latencyMs - previous) : latencyMs;
+}
+
+void DeviceHub::sendOsc(const juce::OSCMessage& message)
+{
+    if (!started.load())
+        return;
+
+    // OSCSender encodes the message into a new block before writing it. That happens under
+    // its own lock, so an audio thread in sendOscPacket() never waits for the allocation.
+    const juce::ScopedLock lock(oscSenderLock);
+    oscSender.send(message);
+}
+
+void DeviceHub::sendOscPacket(const void* data, int size)
+{
+    if (!started.load())
+        return;
+
+    // Writing one datagram is short, a spin lock is enough to keep the audio threads
+    // of different instances from using the socket together
+    const juce::SpinLock::ScopedLockType lock(oscLock);
+    oscSocket.write(ip, port, data, size);
+}
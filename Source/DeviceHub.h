@@ -0,0 +1,119 @@
+/*
+* Process-wide hub shared by all the plugin instances loaded in the same host.
+* It owns the only SerialDevice (one reader thread for all the COM ports), the
+* only OscGestureReceiver and the only OSC socket, so several instances don't
+* fight over the ports or interleave their packets on separate sockets.
+* Gestures from the serial ports and from OSC end up in the same queues.
+*
+* Use it through juce::SharedResourcePointer<DeviceHub>: the hub is created with
+* the first pointer and destroyed with the last one. Creating it is cheap: the ports
+* and sockets are only opened by start(), so a host that instantiates the plugin to
+* scan it, or a session with many instances, doesn't open them over and over.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <mutex>
+#include "Message.h"
+#include "SerialDevice.h"
+#include "OscGestureReceiver.h"
+#include "GesturePredictor.h"
+
+class DeviceHub
+{
+public:
+    DeviceHub();
+    ~DeviceHub();
+
+    // Opens the serial ports, listens for OSC gestures and connects the OSC socket.
+    // Only the first call does anything, the others return at once. Any thread.
+    void start();
+    bool isStarted() const { return started; }
+
+    static constexpr int maxInstances = 32;
+    static constexpr int maxControllers = SerialDevice::maxControllers;
+
+    // Registers a plugin instance and returns its ID, or -1 if there are already maxInstances.
+    // The ID is used to read the sensor data and is sent along with the spectra.
+    int addInstance();
+    void removeInstance(int instanceId);
+
+    // Reads the next message coming from the given controller for this instance.
+    // Must always be called from the same thread (the editor timer).
+    bool popMessage(int instanceId, int controller, Message& message);
+
+    bool isSerialConnected() const { return serialDevice.isAnyConnected(); }
+    bool isOscGestureConnected() const { return gestureReceiver.isConnected(); }
+    bool isGestureInputConnected() const { return isSerialConnected() || isOscGestureConnected(); }
+    bool isControllerConnected(int controller) const { return serialDevice.isConnected(controller); }
+
+    // Gesture prediction, see GesturePredictor.h. The gestures are projected forward by the
+    // latency measured by the editors times the aggressiveness (0 to 1.5). Any thread.
+    void setPrediction(PredictionMode mode, float aggressiveness);
+    PredictionMode getPredictionMode() const { return predictionMode; }
+    float getPredictionAggressiveness() const { return predictionAggressiveness; }
+
+    // The editors report the lag between the sensor sample and the parameter change
+    void reportGestureLatency(float latencyMs);
+    float getGestureLatency() const { return gestureLatencyMs; }
+
+    const PredictionErrors& getPredictionErrors(int controller) const { return predictionErrors[controller]; }
+
+    // Sends a message on the shared socket. Can be called from any thread.
+    // Nothing is sent before start(). OSCSender encodes the message into a new
+    // block every time, so the audio thread uses sendOscPacket() instead.
+    void sendOsc(const juce::OSCMessage& message);
+
+    // Sends an OSC packet already encoded by the caller, on the same socket.
+    // Doesn't allocate and only locks around the write, can be called from the audio thread.
+    // Packets sent often from the message thread, like /meters, go through here as well.
+    void sendOscPacket(const void* data, int size);
+
+private:
+    // Called on the serial thread and on the thread of the OSC jitter buffer for every
+    // message: copies it into the queue of its controller in every registered instance.
+    // The two producers take turns through pushLock; each queue has a single consumer
+    // (the editor of that instance), which reads without locking. A busy controller
+    // can't fill up the queue of the others.
+    void pushMessage(const Message& message);
+    juce::SpinLock pushLock;
+
+    // One predictor per controller and axis, used under pushLock
+    std::array<std::array<GesturePredictor, 3>, maxControllers> predictors;
+    std::array<PredictionErrors, maxControllers> predictionErrors;
+    std::atomic<PredictionMode> predictionMode{ PredictionMode::off };
+    std::atomic<float> predictionAggressiveness{ 1.0f };
+    std::atomic<float> gestureLatencyMs{ 0.0f };
+
+    static constexpr int queueSize = 256;
+
+    struct ControllerQueue {
+        juce::AbstractFifo fifo{ queueSize };
+        std::array<Message, queueSize> messages;
+    };
+    struct InstanceQueues {
+        std::atomic<bool> active{ false };
+        std::array<ControllerQueue, maxControllers> controllers;
+    };
+    std::array<InstanceQueues, maxInstances> queues;
+
+    SerialDevice serialDevice;
+    OscGestureReceiver gestureReceiver;
+    int gesturePort = 7772;
+
+    juce::String ip = "127.0.0.1";
+    int port = 7771;
+
+    // The OSCSender writes to oscSocket too. Each write is one datagram, which the system
+    // sends whole, so the two locks only keep the callers of each function from overlapping.
+    juce::DatagramSocket oscSocket;
+    juce::OSCSender oscSender;
+    juce::SpinLock oscLock;
+    juce::CriticalSection oscSenderLock;
+
+    std::once_flag startFlag;
+    std::atomic<bool> started{ false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceHub)
+};
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "InterleavedBlock.h"
+#include "Crossover.h"
 
 #define float_Pi 3.1415
 
@@ -14,21 +16,140 @@ struct DistortionParameters {
     int hpf_freq, lpf_freq;
 
     int distortion_type;
+
+    // Multiband mode: with more than one band, each band has its own drive (added to
+    // the global drive), mode and mix, and the global mix blends the whole stage.
+    int num_bands;
+    std::array<float, Crossover::maxBands - 1> crossover_freqs;
+    std::array<float, Crossover::maxBands> band_drive, band_mix;
+    std::array<int, Crossover::maxBands> band_type;
 };
 
 
 class Distortion
 {
 public:
+    // Number of waveshaping curves, see distortSamples()
+    static constexpr int numTypes = 4;
+
+    // Normalised coefficients {b0, b1, b2, 1, a1, a2} of the input filters
+    struct InputFilters {
+        std::array<float, 6> hpf, lpf;
+    };
+
+    static DistortionParameters readParameters(const juce::AudioProcessorValueTreeState& apvts)
+    {
+        DistortionParameters target;
+        target.drive = apvts.getRawParameterValue("drive")->load();
+        target.mix = apvts.getRawParameterValue("distortion_mix")->load();
+        target.hpf_freq = apvts.getRawParameterValue("hpf")->load();
+        target.lpf_freq = apvts.getRawParameterValue("lpf")->load();
+        target.distortion_type = static_cast<int>(apvts.getRawParameterValue("distortion_type")->load());
+        target.anger = apvts.getRawParameterValue("anger")->load();
+        target.volume = apvts.getRawParameterValue("volume")->load();
+
+        target.num_bands = static_cast<int>(apvts.getRawParameterValue("distortion_bands")->load()) + 1;
+        for (int k = 0; k < Crossover::maxBands - 1; k++)
+            target.crossover_freqs[k] = apvts.getRawParameterValue("xover_" + juce::String(k + 1))->load();
+        for (int band = 0; band < Crossover::maxBands; band++)
+        {
+            const juce::String prefix = "band" + juce::String(band + 1);
+            target.band_drive[band] = apvts.getRawParameterValue(prefix + "_drive")->load();
+            target.band_mix[band] = apvts.getRawParameterValue(prefix + "_mix")->load();
+            target.band_type[band] = static_cast<int>(apvts.getRawParameterValue(prefix + "_type")->load());
+        }
+
+        // Keep the crossover frequencies increasing, at least a third of an octave apart
+        for (int k = 1; k < Crossover::maxBands - 1; k++)
+            target.crossover_freqs[k] = juce::jmax(target.crossover_freqs[k], target.crossover_freqs[k - 1] * 1.26f);
+
+        return target;
+    }
+
+    // Parameters `position` (0 to 1) of the way from start to target. Frequencies move on
+    // a log scale, choices are the ones of the target.
+    static DistortionParameters interpolate(const DistortionParameters& start, const DistortionParameters& target, float position)
+    {
+        DistortionParameters result = target;
+        result.drive = juce::jmap(position, start.drive, target.drive);
+        result.mix = juce::jmap(position, start.mix, target.mix);
+        result.anger = juce::jmap(position, start.anger, target.anger);
+        result.volume = juce::jmap(position, start.volume, target.volume);
+        result.hpf_freq = juce::roundToInt(interpolateFrequency(float(start.hpf_freq), float(target.hpf_freq), position));
+        result.lpf_freq = juce::roundToInt(interpolateFrequency(float(start.lpf_freq), float(target.lpf_freq), position));
+        for (int k = 0; k < Crossover::maxBands - 1; k++)
+            result.crossover_freqs[k] = interpolateFrequency(start.crossover_freqs[k], target.crossover_freqs[k], position);
+        for (int band = 0; band < Crossover::maxBands; band++)
+        {
+            result.band_drive[band] = juce::jmap(position, start.band_drive[band], target.band_drive[band]);
+            result.band_mix[band] = juce::jmap(position, start.band_mix[band], target.band_mix[band]);
+        }
+        return result;
+    }
+
+    // Meant to be called off the audio thread, when a morph snapshot is stored
+    static InputFilters computeInputFilters(const DistortionParameters& parameters, double sampleRate)
+    {
+        using Coefficients = juce::dsp::IIR::ArrayCoefficients<float>;
+        return { normalise(Coefficients::makeHighPass(sampleRate, parameters.hpf_freq, 5.0f)),
+                 normalise(Coefficients::makeLowPass(sampleRate, parameters.lpf_freq, 5.0f)) };
+    }
+
+    // Reads the values the parameters have to reach by the end of the block. They are
+    // applied by rampParameters(), starting from the values used for the previous block.
     void setParameters(const juce::AudioProcessorValueTreeState& apvts)
     {
-        parameters.drive = apvts.getRawParameterValue("drive")->load();
-        parameters.mix = apvts.getRawParameterValue("distortion_mix")->load();
-        parameters.hpf_freq = apvts.getRawParameterValue("hpf")->load();
-        parameters.lpf_freq = apvts.getRawParameterValue("lpf")->load();
-        parameters.distortion_type = static_cast<int>(apvts.getRawParameterValue("distortion_type")->load());
-        parameters.anger = apvts.getRawParameterValue("anger")->load();
-        parameters.volume = apvts.getRawParameterValue("volume")->load();
+        // The last ramp ended on the previous targets, before any modulation
+        startParameters = targetParameters;
+        targetParameters = readParameters(apvts);
+
+        if (!ramping)
+        {
+            startParameters = parameters = targetParameters;
+            ramping = true;
+        }
+    }
+
+    // Moves the parameters to `position` (0 to 1) of the way between the previous block
+    // and the target. Choices switch straight away.
+    void rampParameters(float position)
+    {
+        parameters = interpolate(startParameters, targetParameters, position);
+    }
+
+    // Replaces the parameters with a morph between two snapshots, until the next
+    // rampParameters(). Choices switch half way. The input filters blend precomputed
+    // coefficients instead of being designed again for every position.
+    void setMorph(const DistortionParameters& from, const DistortionParameters& to,
+                  const InputFilters& fromFilters, const InputFilters& toFilters, float position)
+    {
+        parameters = position < 0.5f ? interpolate(to, from, 1.0f - position) : interpolate(from, to, position);
+
+        // The next block ramps back to the parameters from here, if the morph stops
+        targetParameters = parameters;
+
+        std::array<float, 6> hpf, lpf;
+        for (size_t i = 0; i < hpf.size(); i++)
+        {
+            hpf[i] = fromFilters.hpf[i] + position * (toFilters.hpf[i] - fromFilters.hpf[i]);
+            lpf[i] = fromFilters.lpf[i] + position * (toFilters.lpf[i] - fromFilters.lpf[i]);
+        }
+        setCoefficients(*hpfCoefficients, hpf);
+        setCoefficients(*lpfCoefficients, lpf);
+        filterFreqs = { parameters.hpf_freq, parameters.lpf_freq };
+    }
+
+    float getDrive() const { return parameters.drive; }
+    float getMix() const { return parameters.mix; }
+
+    // Override the values read by setParameters(), for the modulation sources
+    void setDrive(float drive) { parameters.drive = drive; }
+    void setMix(float mix) { parameters.mix = mix; }
+
+    // With a fully dry mix the output is the input
+    bool isNeutral() const
+    {
+        return parameters.mix <= 0.0f;
     }
 
     void prepare(double inputSampleRate, int maxBlockSize, int output_channels)
@@ -37,100 +158,274 @@ public:
         buffer_size = maxBlockSize;
         num_channels = output_channels;
 
-        dryBuffer.setSize(num_channels, maxBlockSize);
+        // Start from the next parameters without a ramp, and compute the filters again
+        ramping = false;
+        filterFreqs = { -1, -1 };
+
+        // The channels are processed in groups of InterleavedBlock::lanes, one lane per channel
+        wetBlock.prepare(num_channels, maxBlockSize);
+        dryBlock.prepare(num_channels, maxBlockSize);
 
         juce::dsp::ProcessSpec spec;
         spec.sampleRate = sample_rate;
         spec.maximumBlockSize = buffer_size;
-        spec.numChannels = num_channels;
+        spec.numChannels = 1;
 
-        filterChain.prepare(spec);
+        *hpfCoefficients = *juce::dsp::IIR::Coefficients<float>::makeHighPass(sample_rate, 20.0f, 5.0f);
+        *lpfCoefficients = *juce::dsp::IIR::Coefficients<float>::makeLowPass(sample_rate, 20000.0f, 5.0f);
+        hpfFilters.resize(wetBlock.getNumGroups());
+        lpfFilters.resize(wetBlock.getNumGroups());
+        for (int group = 0; group < wetBlock.getNumGroups(); group++)
+        {
+            hpfFilters[group].coefficients = hpfCoefficients;
+            lpfFilters[group].coefficients = lpfCoefficients;
+            hpfFilters[group].prepare(spec);
+            lpfFilters[group].prepare(spec);
+        }
+
+        // The bands of one channel at a time, one band per lane
+        crossover.prepare(sample_rate, num_channels);
+        dryCrossover.prepare(sample_rate, num_channels);
+        bandBlock.prepare(InterleavedBlock::lanes, maxBlockSize);
+        shapedBlock.prepare(InterleavedBlock::lanes, maxBlockSize);
+        modeBlock.prepare(InterleavedBlock::lanes, maxBlockSize);
+        resultBlock.prepare(InterleavedBlock::lanes, maxBlockSize);
     }
 
 
     void process(const juce::dsp::ProcessContextReplacing<float>& context)
     {
         auto block = (juce::dsp::AudioBlock<float>&) context.getInputBlock();
+        const int numSamples = static_cast<int>(block.getNumSamples());
 
-        for (int channel = 0; channel < num_channels; channel++)
+        wetBlock.interleave(block);
+        for (int group = 0; group < wetBlock.getNumGroups(); group++)
         {
-            dryBuffer.copyFrom(channel, 0, block.getChannelPointer(channel), buffer_size);
+            std::memcpy(dryBlock.getRawGroup(group), wetBlock.getRawGroup(group),
+                sizeof(float) * numSamples * InterleavedBlock::lanes);
         }
-        applyInputFilters(block);
-        distortBuffer(block);
-        applyMix(block, dryBuffer);
+        applyInputFilters(numSamples);
+        if (parameters.num_bands > 1)
+            distortBands(numSamples);
+        else
+            distortBuffer(numSamples);
+        applyMix(numSamples);
+        wetBlock.deinterleave(block);
     }
 
 private:
     //This function applies filters on the wet distorted signal.
     //The user can decide which frequencies to cut off.
-    void applyInputFilters(juce::dsp::AudioBlock<float>& block)
+    void applyInputFilters(int numSamples)
     {
-        *filterChain.get<FilterChainIndex::HPF>().state = *juce::dsp::IIR::Coefficients<float>::makeHighPass(sample_rate, parameters.hpf_freq, 5.0f);
-        *filterChain.get<FilterChainIndex::LPF>().state = *juce::dsp::IIR::Coefficients<float>::makeLowPass(sample_rate, parameters.lpf_freq, 5.0f);
+        // Written in place, only when the frequencies move: this runs for every sub-block
+        if (filterFreqs.first != parameters.hpf_freq || filterFreqs.second != parameters.lpf_freq)
+        {
+            filterFreqs = { parameters.hpf_freq, parameters.lpf_freq };
+            setCoefficients(*hpfCoefficients, juce::dsp::IIR::ArrayCoefficients<float>::makeHighPass(sample_rate, parameters.hpf_freq, 5.0f));
+            setCoefficients(*lpfCoefficients, juce::dsp::IIR::ArrayCoefficients<float>::makeLowPass(sample_rate, parameters.lpf_freq, 5.0f));
+        }
 
-        juce::dsp::ProcessContextReplacing<float> filterContext(block);
-        filterChain.process(filterContext);
+        for (int group = 0; group < wetBlock.getNumGroups(); group++)
+        {
+            auto groupBlock = wetBlock.getGroup(group, numSamples);
+            juce::dsp::ProcessContextReplacing<InterleavedBlock::Register> filterContext(groupBlock);
+            hpfFilters[group].process(filterContext);
+            lpfFilters[group].process(filterContext);
+        }
+    }
+
+    // Coefficients as {b0, b1, b2, a0, a1, a2}, stored normalised without allocating
+    static void setCoefficients(juce::dsp::IIR::Coefficients<float>& coefficients, const std::array<float, 6>& values)
+    {
+        float* raw = coefficients.getRawCoefficients();
+        raw[0] = values[0] / values[3];
+        raw[1] = values[1] / values[3];
+        raw[2] = values[2] / values[3];
+        raw[3] = values[4] / values[3];
+        raw[4] = values[5] / values[3];
+    }
+
+    static std::array<float, 6> normalise(const std::array<float, 6>& c)
+    {
+        return { c[0] / c[3], c[1] / c[3], c[2] / c[3], 1.0f, c[4] / c[3], c[5] / c[3] };
+    }
+
+    static float interpolateFrequency(float start, float target, float position)
+    {
+        if (start <= 0.0f || target <= 0.0f)
+            return target;
+        return start * std::pow(target / start, position);
     }
 
-    void distortBuffer(juce::dsp::AudioBlock<float>& block)
+    // The samples of a group are contiguous floats, so these loops process all the
+    // channels of a group together and can be vectorised by the compiler.
+    void distortBuffer(int numSamples)
     {
+        const float driveGain = (parameters.drive / 10.0f) + 1.0f;
         const float outputGain = juce::Decibels::decibelsToGain(parameters.volume);
         const float autoGain = juce::Decibels::decibelsToGain(parameters.drive / -5.0f) *
             (-0.7f * parameters.anger + 1.0f);
-        for (int sample = 0; sample < buffer_size; sample++)
+        const int numValues = numSamples * InterleavedBlock::lanes;
+
+        for (int group = 0; group < wetBlock.getNumGroups(); group++)
         {
-            for (int channel = 0; channel < num_channels; channel++)
+            float* wet = wetBlock.getRawGroup(group);
+            juce::FloatVectorOperations::multiply(wet, driveGain, numValues);     // apply drive
+            distortSamples(wet, numValues, parameters.distortion_type);          // apply distortion
+            juce::FloatVectorOperations::multiply(wet, autoGain * outputGain, numValues); // apply autogain and volume
+        }
+    }
+
+    // Multiband version of distortBuffer(): each channel is split into bands, one band per
+    // lane, so drive, mix and gain are one SIMD multiply for all the bands together.
+    void distortBands(int numSamples)
+    {
+        using Register = InterleavedBlock::Register;
+
+        crossover.setBands(parameters.num_bands, parameters.crossover_freqs);
+        dryCrossover.setBands(parameters.num_bands, parameters.crossover_freqs);
+
+        const float outputGain = juce::Decibels::decibelsToGain(parameters.volume);
+        const float angerGain = -0.7f * parameters.anger + 1.0f;
+
+        // Per band gains: unused bands are silent already, their gains don't matter
+        Register driveGains, dryGains, wetGains;
+        std::array<bool, numTypes> modeUsed{};
+        for (int band = 0; band < InterleavedBlock::lanes; band++)
+        {
+            const int b = juce::jmin(band, Crossover::maxBands - 1);
+            const float drive = juce::jlimit(0.0f, 100.0f, parameters.drive + parameters.band_drive[b]);
+            const float autoGain = juce::Decibels::decibelsToGain(drive / -5.0f) * angerGain;
+            driveGains.set(static_cast<size_t>(band), (drive / 10.0f) + 1.0f);
+            dryGains.set(static_cast<size_t>(band), 1.0f - parameters.band_mix[b]);
+            wetGains.set(static_cast<size_t>(band), parameters.band_mix[b] * autoGain * outputGain);
+            if (band < parameters.num_bands)
+                modeUsed[juce::jlimit(0, numTypes - 1, parameters.band_type[b])] = true;
+        }
+
+        int numModes = 0;
+        for (bool used : modeUsed)
+            numModes += used ? 1 : 0;
+
+        Register* bands = bandBlock.getGroup(0, numSamples).getChannelPointer(0);
+        Register* shaped = shapedBlock.getGroup(0, numSamples).getChannelPointer(0);
+        Register* moded = modeBlock.getGroup(0, numSamples).getChannelPointer(0);
+        Register* result = resultBlock.getGroup(0, numSamples).getChannelPointer(0);
+        const int numValues = numSamples * InterleavedBlock::lanes;
+
+        for (int channel = 0; channel < num_channels; channel++)
+        {
+            // The bands sum back to an allpassed input, so the dry signal of the global mix
+            // goes through the same split: blending it with the unfiltered input would comb
+            // filter around the crossover frequencies.
+            float* dry = dryBlock.getRawGroup(channel / InterleavedBlock::lanes) + channel % InterleavedBlock::lanes;
+            dryCrossover.split(channel, dry, InterleavedBlock::lanes, moded, numSamples);
+            for (int i = 0; i < numSamples; i++)
+                dry[i * InterleavedBlock::lanes] = moded[i].sum();
+
+            float* wet = wetBlock.getRawGroup(channel / InterleavedBlock::lanes) + channel % InterleavedBlock::lanes;
+            crossover.split(channel, wet, InterleavedBlock::lanes, bands, numSamples);
+
+            for (int i = 0; i < numSamples; i++)
+                shaped[i] = bands[i] * driveGains;
+
+            // With a single mode all the bands are shaped in place. Otherwise each mode in use
+            // shapes all the lanes and only the lanes of the bands using it are kept.
+            if (numModes == 1)
             {
-                float wetSample = block.getSample(channel, sample);
-                wetSample *= (parameters.drive / 10.0f) + 1.0f;         // apply drive
-                distortSample(wetSample, parameters.distortion_type);    // apply distortion
-                wetSample *= autoGain;                                  // apply autogain
-                wetSample *= outputGain;                                // apply volume
-                block.setSample(channel, sample, wetSample);
+                distortSamples(reinterpret_cast<float*>(shaped), numValues, parameters.band_type[0]);
             }
+            else
+            {
+                std::fill(reinterpret_cast<float*>(result), reinterpret_cast<float*>(result) + numValues, 0.0f);
+                for (int type = 0; type < numTypes; type++)
+                {
+                    if (!modeUsed[type])
+                        continue;
+
+                    Register mask = Register::expand(0.0f);
+                    for (int band = 0; band < parameters.num_bands; band++)
+                        if (parameters.band_type[band] == type)
+                            mask.set(static_cast<size_t>(band), 1.0f);
+
+                    std::memcpy(moded, shaped, sizeof(float) * numValues);
+                    distortSamples(reinterpret_cast<float*>(moded), numValues, type);
+                    for (int i = 0; i < numSamples; i++)
+                        result[i] += moded[i] * mask;
+                }
+                std::memcpy(shaped, result, sizeof(float) * numValues);
+            }
+
+            // Per band mix, then the bands are summed back into the channel
+            for (int i = 0; i < numSamples; i++)
+                wet[i * InterleavedBlock::lanes] = (bands[i] * dryGains + shaped[i] * wetGains).sum();
         }
     }
 
-    //Distort the sample as input using a non linear function
-    void distortSample(float& sample, int type)
+    //Distort the samples as input using a non linear function
+    void distortSamples(float* samples, int numValues, int type)
     {
-        float angerValue;
+        const float angerValue = -0.9f * parameters.anger + 1.0f;
         switch (type)
         {
         case 0: // inverse absolute value
-            angerValue = -0.9f * parameters.anger + 1.0f;
-            sample = sample / (angerValue + abs(sample));
+            for (int i = 0; i < numValues; i++)
+                samples[i] = samples[i] / (angerValue + std::abs(samples[i]));
+            break;
+        case 1: // hard clipping
+            for (int i = 0; i < numValues; i++)
+                samples[i] = juce::jlimit(-1.0f, 1.0f, samples[i] / angerValue);
+            break;
+        case 2: // hyperbolic tangent
+            for (int i = 0; i < numValues; i++)
+                samples[i] = std::tanh(samples[i] / angerValue);
+            break;
+        case 3: // sine wavefolder
+            for (int i = 0; i < numValues; i++)
+                samples[i] = std::sin(samples[i] / angerValue);
             break;
         }
     }
 
     //Regulates the Dey/Wet mix
-    void applyMix(juce::dsp::AudioBlock<float>& wetBlock, const juce::AudioBuffer<float>& dryBlock)
+    void applyMix(int numSamples)
     {
-        for (int sample = 0; sample < buffer_size; sample++)
+        const int numValues = numSamples * InterleavedBlock::lanes;
+
+        for (int group = 0; group < wetBlock.getNumGroups(); group++)
         {
-            for (int channel = 0; channel < num_channels; channel++)
-            {
-                const float wetSample = wetBlock.getSample(channel, sample) * parameters.mix;
-                const float drySample = dryBlock.getSample(channel, sample) * (1.0f - parameters.mix);
-                wetBlock.setSample(channel, sample, wetSample + drySample);
-            }
+            float* wet = wetBlock.getRawGroup(group);
+            juce::FloatVectorOperations::multiply(wet, parameters.mix, numValues);
+            juce::FloatVectorOperations::addWithMultiply(wet, dryBlock.getRawGroup(group), 1.0f - parameters.mix, numValues);
         }
     }
 
-    DistortionParameters parameters;
+    // Parameters in use, and the two ends of the ramp of the current block
+    DistortionParameters parameters{};
+    DistortionParameters startParameters{}, targetParameters{};
+    bool ramping = false;
+
+    // hpf and lpf frequencies the input filters were computed for
+    std::pair<int, int> filterFreqs{ -1, -1 };
     int num_channels;
     double sample_rate;
     int buffer_size;
 
-    //Dry signal buffer
-    juce::AudioBuffer<float> dryBuffer;
+    //Wet and dry signals, interleaved in groups of channels
+    InterleavedBlock wetBlock;
+    InterleavedBlock dryBlock;
+
+    //We filter out very low frequencies and very high frequencies before applying distortion.
+    //There is one filter per group of channels, all sharing the same coefficients.
+    using SIMDFilter = juce::dsp::IIR::Filter<InterleavedBlock::Register>;
+    std::vector<SIMDFilter> hpfFilters, lpfFilters;
+    juce::dsp::IIR::Coefficients<float>::Ptr hpfCoefficients{ new juce::dsp::IIR::Coefficients<float>(1.0f, 0.0f, 1.0f, 0.0f) };
+    juce::dsp::IIR::Coefficients<float>::Ptr lpfCoefficients{ new juce::dsp::IIR::Coefficients<float>(1.0f, 0.0f, 1.0f, 0.0f) };
 
-    //We filter out very low frequencies and very high frequencies before applying distortion
-    using StereoFilter = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>,
-        juce::dsp::IIR::Coefficients<float>>;
-    juce::dsp::ProcessorChain<StereoFilter, StereoFilter> filterChain;
-    enum FilterChainIndex { HPF, LPF};
+    //Multiband mode: the crossover and the bands of the channel being processed, and the
+    //crossover of the dry signal, only used for its allpass response
+    Crossover crossover, dryCrossover;
+    InterleavedBlock bandBlock, shapedBlock, modeBlock, resultBlock;
 
 };
@@ -0,0 +1,173 @@
+/*
+  This class implements the envelope follower, a modulation source driven by the input
+  signal. It contains functions to set its parameters, to follow the input audio and to
+  modulate the parameter it is routed to. These functions are called from
+  EQAudioProcessor::processBlock().
+
+  The input channels are summed, high-passed (so the bass doesn't dominate the envelope)
+  and their peak is followed in sub-blocks of subBlockSize samples, with separate attack
+  and release times. The envelope is mapped from -60..0 dBFS to 0..1 and moves the target
+  parameter by depth * envelope, in the normalised range of the parameter. The envelope of
+  every sub-block of the last block is kept, so the target can follow it within the block.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Parameters the envelope follower can be routed to, in the order of the "env_target" choices
+enum class ModulationTarget
+{
+    none,
+    eqCutoff,
+    drive,
+    distortionMix,
+    delayGain
+};
+
+struct EnvelopeParameters {
+    float attackMs, releaseMs;
+    float filterFreq;
+    ModulationTarget target;
+    float depth;
+};
+
+class EnvelopeFollower {
+
+public:
+    void setParameters(const juce::AudioProcessorValueTreeState& apvts)
+    {
+        parameters.attackMs = apvts.getRawParameterValue("env_attack")->load();
+        parameters.releaseMs = apvts.getRawParameterValue("env_release")->load();
+        parameters.filterFreq = apvts.getRawParameterValue("env_filter")->load();
+        parameters.target = static_cast<ModulationTarget>(static_cast<int>(apvts.getRawParameterValue("env_target")->load()));
+        parameters.depth = apvts.getRawParameterValue("env_depth")->load();
+    }
+
+    ModulationTarget getTarget() const { return parameters.target; }
+
+    // Current envelope, between 0 and 1
+    float getEnvelope() const { return envelope; }
+
+    void prepare(double sampleRate, int maxBlockSize)
+    {
+        this->sampleRate = sampleRate;
+
+        sidechain.setSize(1, maxBlockSize);
+        history.assign(static_cast<size_t>(maxBlockSize / subBlockSize + 1), 0.0f);
+
+        juce::dsp::ProcessSpec spec;
+        spec.sampleRate = sampleRate;
+        spec.maximumBlockSize = maxBlockSize;
+        spec.numChannels = 1;
+
+        // Second order from the start, so process() only overwrites the values: a new
+        // coefficients object or a larger state would allocate on the audio thread
+        filter.coefficients = juce::dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, parameters.filterFreq);
+        filter.prepare(spec);
+
+        filterFreq = parameters.filterFreq;
+        reset();
+    }
+
+    void reset()
+    {
+        filter.reset();
+        level = 0.0f;
+        envelope = 0.0f;
+        numHistory = 0;
+    }
+
+    // Follows the input. Nothing is computed while the envelope is not routed anywhere.
+    void process(const juce::AudioBuffer<float>& buffer)
+    {
+        if (parameters.target == ModulationTarget::none || buffer.getNumChannels() == 0)
+            return;
+
+        if (parameters.filterFreq != filterFreq) {
+            filterFreq = parameters.filterFreq;
+            setCoefficients(juce::dsp::IIR::ArrayCoefficients<float>::makeHighPass(sampleRate, filterFreq));
+        }
+
+        const float attack = coefficient(parameters.attackMs);
+        const float release = coefficient(parameters.releaseMs);
+        const int numChannels = buffer.getNumChannels();
+        numHistory = 0;
+
+        for (int start = 0; start < buffer.getNumSamples(); start += sidechain.getNumSamples()) {
+            const int numSamples = juce::jmin(sidechain.getNumSamples(), buffer.getNumSamples() - start);
+
+            // Mono sum of the input, then the pre-filter
+            float* mono = sidechain.getWritePointer(0);
+            juce::FloatVectorOperations::copy(mono, buffer.getReadPointer(0, start), numSamples);
+            for (int channel = 1; channel < numChannels; ++channel)
+                juce::FloatVectorOperations::add(mono, buffer.getReadPointer(channel, start), numSamples);
+            juce::FloatVectorOperations::multiply(mono, 1.0f / numChannels, numSamples);
+
+            juce::dsp::AudioBlock<float> block(&mono, 1, static_cast<size_t>(numSamples));
+            filter.process(juce::dsp::ProcessContextReplacing<float>(block));
+
+            // Peak of each sub-block through the attack/release smoother
+            for (int offset = 0; offset < numSamples; offset += subBlockSize) {
+                const auto range = juce::FloatVectorOperations::findMinAndMax(mono + offset, juce::jmin(subBlockSize, numSamples - offset));
+                const float peak = juce::jmax(-range.getStart(), range.getEnd());
+                level = peak + (peak > level ? attack : release) * (level - peak);
+
+                envelope = juce::jlimit(0.0f, 1.0f, (juce::Decibels::gainToDecibels(level, floorDb) - floorDb) / -floorDb);
+                if (numHistory < static_cast<int>(history.size()))
+                    history[static_cast<size_t>(numHistory++)] = envelope;
+            }
+        }
+    }
+
+    // Returns `value`, the value of parameterID, moved by the envelope at sample `sampleIndex`
+    // of the last block if the follower is routed to `target`.
+    float modulate(ModulationTarget target, const juce::AudioProcessorValueTreeState& apvts, const juce::String& parameterID,
+                   float value, int sampleIndex) const
+    {
+        if (target != parameters.target)
+            return value;
+
+        const float amount = numHistory > 0 ? history[static_cast<size_t>(juce::jlimit(0, numHistory - 1, sampleIndex / subBlockSize))]
+                                            : envelope;
+        const auto& range = apvts.getParameterRange(parameterID);
+        const float normalised = juce::jlimit(0.0f, 1.0f, range.convertTo0to1(value) + parameters.depth * amount);
+        return range.convertFrom0to1(normalised);
+    }
+
+private:
+    static constexpr int subBlockSize = 32;
+    static constexpr float floorDb = -60.0f;
+
+    EnvelopeParameters parameters{ 10.0f, 200.0f, 100.0f, ModulationTarget::none, 0.5f };
+
+    double sampleRate{ 44100.0 };
+    float filterFreq{ 0.0f };
+
+    juce::dsp::IIR::Filter<float> filter;
+    juce::AudioBuffer<float> sidechain;
+
+    float level{ 0.0f };
+    float envelope{ 0.0f };
+
+    // Envelope at the end of each sub-block of the last block
+    std::vector<float> history;
+    int numHistory{ 0 };
+
+    // Coefficients as {b0, b1, b2, a0, a1, a2}, stored normalised in place, like Distortion does
+    void setCoefficients(const std::array<float, 6>& values)
+    {
+        float* raw = filter.coefficients->getRawCoefficients();
+        raw[0] = values[0] / values[3];
+        raw[1] = values[1] / values[3];
+        raw[2] = values[2] / values[3];
+        raw[3] = values[4] / values[3];
+        raw[4] = values[5] / values[3];
+    }
+
+    // One-pole coefficient for a time constant of timeMs, updated once per sub-block
+    float coefficient(float timeMs) const
+    {
+        return static_cast<float>(std::exp(-subBlockSize / (0.001 * timeMs * sampleRate)));
+    }
+};
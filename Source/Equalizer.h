@@ -1,25 +1,193 @@
 /*
-  This class implements the Equalizer. It contains functions to set the distortion parameters and
+  This class implements the Equalizer. It contains functions to set the equalizer parameters and
   to process the input audio. These function are called from EQAudioProcessor::processBlock()
+
+  The main filter (low, high or band pass) is followed by numBands parametric bands. All
+  of them run in a single BiquadCascade, and the coefficients of a filter are computed
+  again only when its parameters change. For preset morphing, the coefficients of every
+  slot can also be computed in advance with computeSections() and blended with setMorph().
 */
 
 #pragma once
 
+#include "BiquadCascade.h"
+
+// Types of the parametric bands, in the order of the "eqN_type" choices
+enum class BandType
+{
+    peak,
+    lowShelf,
+    highShelf,
+    notch,
+    lowCut,
+    highCut
+};
+
+struct BandParameters {
+    bool enabled;
+    int type;
+    float freq;
+    float gainDb;
+    float qFactor;
+    int slope;          // cut filters: 12, 24, 36 or 48 dB/oct, as 0..3
+
+    bool operator==(const BandParameters& other) const {
+        return enabled == other.enabled && type == other.type && freq == other.freq
+            && gainDb == other.gainDb && qFactor == other.qFactor && slope == other.slope;
+    }
+    bool operator!=(const BandParameters& other) const { return !(*this == other); }
+};
+
 struct EqualizerParameters {
     int cutoffFreq;
     float qFactor;
     int type;
+
+    bool operator==(const EqualizerParameters& other) const {
+        return cutoffFreq == other.cutoffFreq && qFactor == other.qFactor && type == other.type;
+    }
+    bool operator!=(const EqualizerParameters& other) const { return !(*this == other); }
 };
 
 class Equalizer {
 
 public:
-    void setParameters(const juce::AudioProcessorValueTreeState& apvts)
+    // Parametric bands after the main filter, each up to maxSectionsPerBand biquads (48 dB/oct)
+    static constexpr int numBands = 6;
+    static constexpr int maxSectionsPerBand = 4;
+    static constexpr int numSlots = 1 + numBands * maxSectionsPerBand;
+
+    using Bands = std::array<BandParameters, numBands>;
+
+    // Normalised coefficients {b0, b1, b2, 1, a1, a2} of every slot of the cascade
+    struct Sections {
+        std::array<std::array<float, 6>, numSlots> coefficients;
+        std::array<bool, numSlots> enabled;
+    };
+
+    static void readParameters(const juce::AudioProcessorValueTreeState& apvts, EqualizerParameters& parameters, Bands& bands)
     {
         parameters.cutoffFreq = apvts.getRawParameterValue("EQcutoff")->load();
         parameters.qFactor = apvts.getRawParameterValue("Q")->load();
         parameters.type = static_cast<int>(apvts.getRawParameterValue("type")->load());
 
+        for (int band = 0; band < numBands; band++) {
+            const juce::String prefix = "eq" + juce::String(band + 1);
+            auto& bandParameters = bands[band];
+            bandParameters.enabled = apvts.getRawParameterValue(prefix + "_on")->load() > 0.5f;
+            bandParameters.type = static_cast<int>(apvts.getRawParameterValue(prefix + "_type")->load());
+            bandParameters.freq = apvts.getRawParameterValue(prefix + "_freq")->load();
+            bandParameters.gainDb = apvts.getRawParameterValue(prefix + "_gain")->load();
+            bandParameters.qFactor = apvts.getRawParameterValue(prefix + "_q")->load();
+            bandParameters.slope = static_cast<int>(apvts.getRawParameterValue(prefix + "_slope")->load());
+        }
+    }
+
+    // Computes the coefficients of all the slots at once. Allocation free, but meant to be
+    // called off the audio thread, when a morph snapshot is stored.
+    static Sections computeSections(const EqualizerParameters& parameters, const Bands& bands, double sampleRate) {
+        Sections sections;
+        sections.coefficients.fill(identity);
+        sections.enabled.fill(false);
+
+        sections.coefficients[0] = normalise(computeMainFilter(parameters, sampleRate));
+        sections.enabled[0] = true;
+
+        for (int band = 0; band < numBands; band++) {
+            const int firstSlot = 1 + band * maxSectionsPerBand;
+            const int numSections = computeBand(bands[band], sampleRate, &sections.coefficients[firstSlot]);
+            for (int section = 0; section < numSections; section++) {
+                sections.coefficients[firstSlot + section] = normalise(sections.coefficients[firstSlot + section]);
+                sections.enabled[firstSlot + section] = bands[band].enabled;
+            }
+        }
+        return sections;
+    }
+
+    // Reads the values the parameters have to reach by the end of the block. They are
+    // applied by rampParameters(), starting from the values used for the previous block.
+    void setParameters(const juce::AudioProcessorValueTreeState& apvts)
+    {
+        // The last ramp ended on the previous targets, before any modulation
+        startParameters = targetParameters;
+        startBands = targetBands;
+
+        readParameters(apvts, targetParameters, targetBands);
+
+        // Back from a morph: every slot has to be computed again from the parameters
+        if (morphing) {
+            morphing = false;
+            invalidateCoefficients();
+        }
+
+        if (!ramping) {
+            startParameters = parameters = targetParameters;
+            startBands = bands = targetBands;
+            ramping = true;
+        }
+    }
+
+    // Moves the parameters to `position` (0 to 1) of the way between the previous block
+    // and the target. Frequencies move on a log scale, choices switch straight away.
+    void rampParameters(float position) {
+        parameters.type = targetParameters.type;
+        parameters.cutoffFreq = juce::roundToInt(interpolateFrequency(float(startParameters.cutoffFreq), float(targetParameters.cutoffFreq), position));
+        parameters.qFactor = juce::jmap(position, startParameters.qFactor, targetParameters.qFactor);
+
+        for (int band = 0; band < numBands; band++) {
+            const auto& start = startBands[band];
+            const auto& target = targetBands[band];
+            auto& current = bands[band];
+            current.enabled = target.enabled;
+            current.type = target.type;
+            current.slope = target.slope;
+            current.freq = interpolateFrequency(start.freq, target.freq, position);
+            current.gainDb = juce::jmap(position, start.gainDb, target.gainDb);
+            current.qFactor = juce::jmap(position, start.qFactor, target.qFactor);
+        }
+    }
+
+    // Replaces the coefficients computed from the parameters with a blend of two precomputed
+    // sets, until the next setParameters(). A slot used on one side only is blended with a
+    // pass-through section. Blends of stable biquads are stable, so any position is safe.
+    void setMorph(const Sections& from, const Sections& to, float position) {
+        morphing = true;
+        for (int slot = 0; slot < numSlots; slot++) {
+            const bool enabled = from.enabled[slot] || to.enabled[slot];
+            if (enabled) {
+                const auto& a = from.enabled[slot] ? from.coefficients[slot] : identity;
+                const auto& b = to.enabled[slot] ? to.coefficients[slot] : identity;
+                std::array<float, 6> blend;
+                for (size_t i = 0; i < blend.size(); i++)
+                    blend[i] = a[i] + position * (b[i] - a[i]);
+                cascade.setSection(slot, blend);
+            }
+            cascade.setEnabled(slot, enabled);
+        }
+    }
+
+    int getCutoff() const { return parameters.cutoffFreq; }
+
+    // Overrides the cutoff read by setParameters(), for the modulation sources
+    void setCutoff(float cutoffFreq) {
+        parameters.cutoffFreq = static_cast<int>(cutoffFreq);
+    }
+
+    // A low pass at the top of the cutoff range lets everything through, and so do
+    // disabled bands and bells or shelves at 0 dB
+    bool isNeutral() const {
+        if (morphing)
+            return false;
+        if (!(parameters.type == 0 && parameters.cutoffFreq >= 20000))
+            return false;
+
+        for (const auto& band : bands) {
+            const auto type = static_cast<BandType>(band.type);
+            const bool flat = type == BandType::peak || type == BandType::lowShelf || type == BandType::highShelf;
+            if (band.enabled && !(flat && band.gainDb == 0.0f))
+                return false;
+        }
+        return true;
     }
 
     void prepare(int sampleRate, int bufferSize, int nChannels) {
@@ -27,11 +195,14 @@ public:
         this->bufferSize = bufferSize;
         this->nChannels = nChannels;
 
-        juce::dsp::ProcessSpec spec;
-        spec.sampleRate = sampleRate;
-        spec.maximumBlockSize = bufferSize;
-        spec.numChannels = nChannels;
-        filter.prepare(spec);
+        // The channels are processed in groups of InterleavedBlock::lanes, one cascade state per group
+        interleaved.prepare(nChannels, bufferSize);
+        cascade.prepare(interleaved.getNumGroups());
+
+        // Start from the next parameters without a ramp, and compute all the coefficients
+        ramping = false;
+        morphing = false;
+        invalidateCoefficients();
     }
 
     void process(const juce::dsp::ProcessContextReplacing<float>& context) {
@@ -43,30 +214,135 @@ public:
 
 private:
     void applyFilter(juce::dsp::AudioBlock<float>& block) {
+        if (!morphing)
+            updateCoefficients();
+
+        const int numSamples = static_cast<int>(block.getNumSamples());
+
+        interleaved.interleave(block);
+        for (int group = 0; group < interleaved.getNumGroups(); group++)
+        {
+            auto groupBlock = interleaved.getGroup(group, numSamples);
+            cascade.process(group, groupBlock.getChannelPointer(0), numSamples);
+        }
+        interleaved.deinterleave(block);
+    }
+
+    // Only the filters whose parameters changed since the last block get new coefficients
+    void updateCoefficients() {
+        using Coefficients = juce::dsp::IIR::ArrayCoefficients<float>;
+
+        if (parameters != computedParameters) {
+            computedParameters = parameters;
+            cascade.setSection(0, computeMainFilter(parameters, sampleRate));
+            cascade.setEnabled(0, true);
+        }
+
+        for (int band = 0; band < numBands; band++) {
+            const auto& bandParameters = bands[band];
+            if (bandParameters == computedBands[band])
+                continue;
+            computedBands[band] = bandParameters;
+
+            const int firstSlot = 1 + band * maxSectionsPerBand;
+            std::array<std::array<float, 6>, maxSectionsPerBand> sections;
+            const int numSections = computeBand(bandParameters, sampleRate, sections.data());
+            for (int section = 0; section < numSections; section++)
+                cascade.setSection(firstSlot + section, sections[section]);
+
+            for (int section = 0; section < maxSectionsPerBand; section++)
+                cascade.setEnabled(firstSlot + section, bandParameters.enabled && section < numSections);
+        }
+    }
+
+    void invalidateCoefficients() {
+        computedParameters.cutoffFreq = -1;
+        for (auto& band : computedBands)
+            band.freq = -1.0f;
+    }
+
+    static std::array<float, 6> computeMainFilter(const EqualizerParameters& parameters, double sampleRate) {
+        using Coefficients = juce::dsp::IIR::ArrayCoefficients<float>;
+
         switch (parameters.type)
         {
-        case 0: // Low Pass Filter
-            *filter.state = *juce::dsp::IIR::Coefficients<float>::makeLowPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
-            break;
         case 1: // High Pass Filter
-            *filter.state = *juce::dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
-            break;
+            return Coefficients::makeHighPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
         case 2: // Band Pass Filter
-            *filter.state = *juce::dsp::IIR::Coefficients<float>::makeBandPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
-            break;
+            return Coefficients::makeBandPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
+        default: // Low Pass Filter
+            return Coefficients::makeLowPass(sampleRate, parameters.cutoffFreq, parameters.qFactor);
         }
+    }
+
+    // Writes the sections of a band to sections[0..maxSectionsPerBand) and returns how many it uses
+    static int computeBand(const BandParameters& bandParameters, double sampleRate, std::array<float, 6>* sections) {
+        using Coefficients = juce::dsp::IIR::ArrayCoefficients<float>;
+
+        const float freq = juce::jmin(bandParameters.freq, static_cast<float>(0.45 * sampleRate));
+        const float gain = juce::Decibels::decibelsToGain(bandParameters.gainDb);
 
-        juce::dsp::ProcessContextReplacing<float> filterContext(block);
-        filter.process(filterContext);
+        switch (static_cast<BandType>(bandParameters.type))
+        {
+        case BandType::lowShelf:
+            sections[0] = Coefficients::makeLowShelf(sampleRate, freq, bandParameters.qFactor, gain);
+            return 1;
+        case BandType::highShelf:
+            sections[0] = Coefficients::makeHighShelf(sampleRate, freq, bandParameters.qFactor, gain);
+            return 1;
+        case BandType::notch:
+            sections[0] = Coefficients::makeNotch(sampleRate, freq, bandParameters.qFactor);
+            return 1;
+        case BandType::lowCut:
+        case BandType::highCut: {
+            // Butterworth of order 2 * numSections, as a cascade of second order sections
+            const int numSections = juce::jlimit(1, maxSectionsPerBand, bandParameters.slope + 1);
+            for (int section = 0; section < numSections; section++) {
+                const float q = static_cast<float>(1.0 / (2.0 * std::cos(juce::MathConstants<double>::pi * (2 * section + 1) / (4.0 * numSections))));
+                sections[section] = static_cast<BandType>(bandParameters.type) == BandType::lowCut
+                    ? Coefficients::makeHighPass(sampleRate, freq, q)
+                    : Coefficients::makeLowPass(sampleRate, freq, q);
+            }
+            return numSections;
+        }
+        default:
+            sections[0] = Coefficients::makePeakFilter(sampleRate, freq, bandParameters.qFactor, gain);
+            return 1;
+        }
+    }
+
+    static std::array<float, 6> normalise(const std::array<float, 6>& c) {
+        return { c[0] / c[3], c[1] / c[3], c[2] / c[3], 1.0f, c[4] / c[3], c[5] / c[3] };
     }
 
-    EqualizerParameters parameters;
+    static constexpr std::array<float, 6> identity{ 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+
+    static float interpolateFrequency(float start, float target, float position) {
+        if (start <= 0.0f || target <= 0.0f)
+            return target;
+        return start * std::pow(target / start, position);
+    }
+
+    // Parameters in use, and the two ends of the ramp of the current block
+    EqualizerParameters parameters{ 20000, 0.71f, 0 };
+    std::array<BandParameters, numBands> bands{};
+    EqualizerParameters startParameters{ 20000, 0.71f, 0 }, targetParameters{ 20000, 0.71f, 0 };
+    std::array<BandParameters, numBands> startBands{}, targetBands{};
+    bool ramping = false;
+
+    // True while the cascade runs coefficients set by setMorph()
+    bool morphing = false;
+
+    // Parameters the current coefficients were computed for
+    EqualizerParameters computedParameters{ -1, 0.0f, 0 };
+    std::array<BandParameters, numBands> computedBands{};
 
     int sampleRate;
     int bufferSize;
     int nChannels;
 
-    using StereoFilter = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>,
-        juce::dsp::IIR::Coefficients<float>>;
-    StereoFilter filter;
+    // Slot 0 is the main filter, then maxSectionsPerBand slots per parametric band
+    BiquadCascade<1 + numBands * maxSectionsPerBand> cascade;
+
+    InterleavedBlock interleaved;
 };
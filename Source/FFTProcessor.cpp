@@ -1,13 +1,62 @@
 #include "FFTProcessor.h"
 
-FFTProcessor::FFTProcessor() :
-    fft(fftOrder),
-    window(fftSize + 1, juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false)
+FFTProcessor::FFTProcessor()
 {
-    // Note that the window is of length `fftSize + 1` because JUCE's windows
-    // are symmetrical, which is wrong for overlap-add processing. To make the
-    // window periodic, set size to 1025 but only use the first 1024 samples.
+}
+
+FFTProcessor::Tables::Tables()
+{
+    for (int i = 0; i < numFftOrders; ++i) {
+        const int size = 1 << (minFftOrder + i);
+        ffts[i] = std::make_unique<juce::dsp::FFT>(minFftOrder + i);
+
+        // Note that the window is of length `size + 1` because JUCE's windows
+        // are symmetrical, which is wrong for overlap-add processing. To make the
+        // window periodic, compute 1025 points but only use the first 1024 samples.
+        windowTables[i].resize(size + 1);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(windowTables[i].data(), size + 1,
+            juce::dsp::WindowingFunction<float>::WindowingMethod::hann, false);
+    }
+}
 
+const FFTProcessor::Tables& FFTProcessor::getTables()
+{
+    static const Tables shared;
+    return shared;
+}
+
+bool FFTProcessor::setResolution(int newFftOrder, int newOverlap)
+{
+    if (newFftOrder < minFftOrder || newFftOrder > maxFftOrder)
+        return false;
+    if (newOverlap != 4 && newOverlap != 8)
+        return false;
+
+    pendingResolution = newFftOrder * 16 + newOverlap;
+    return true;
+}
+
+void FFTProcessor::applyPendingResolution()
+{
+    const int resolution = pendingResolution.load();
+    const int newFftOrder = resolution / 16;
+    const int newOverlap = resolution % 16;
+    if (newFftOrder == fftOrder && newOverlap == overlap)
+        return;
+
+    fftOrder = newFftOrder;
+    fftSize = 1 << fftOrder;
+    numBins = fftSize / 2 + 1;
+    overlap = newOverlap;
+    hopSize = fftSize / overlap;
+    windowCorrection = 1.0f / (0.375f * float(overlap));
+
+    fft = tables->ffts[fftOrder - minFftOrder].get();
+    window = tables->windowTables[fftOrder - minFftOrder].data();
+
+    // The old FIFO contents don't line up with the new frames anymore.
+    reset();
+    updateFramesPerPublish();
 }
 
 void FFTProcessor::reset()
@@ -16,108 +65,349 @@ void FFTProcessor::reset()
     pos = 0;
 
     // Zero out the circular buffers.
-    std::fill(inputFifo.begin(), inputFifo.end(), 0.0f);
-    std::fill(outputFifo.begin(), outputFifo.end(), 0.0f);
+    for (int channel = 0; channel < preparedChannels; ++channel) {
+        std::fill(inputFifo[channel].begin(), inputFifo[channel].end(), 0.0f);
+        std::fill(outputFifo[channel].begin(), outputFifo[channel].end(), 0.0f);
+        frozenCaptured[channel] = false;
+    }
+
+    clearAggregation();
 }
 
-void FFTProcessor::processBlock(float* data, int numSamples, bool bypassed)
+void FFTProcessor::clearAggregation()
 {
-    for (int i = 0; i < numSamples; ++i) {
-        data[i] = processSample(data[i], bypassed);
+    for (auto& spectrum : aggregatedSpectrum) {
+        std::fill(spectrum.begin(), spectrum.end(), 0.0f);
     }
+    aggregatedFrames = 0;
 }
 
-float FFTProcessor::processSample(float sample, bool bypassed)
+void FFTProcessor::prepare(double newSampleRate, int numChannels)
 {
-    // Push the new sample value into the input FIFO.
-    inputFifo[pos] = sample;
+    if (tables == nullptr) {
+        tables = &getTables();
+        fft = tables->ffts[fftOrder - minFftOrder].get();
+        window = tables->windowTables[fftOrder - minFftOrder].data();
+    }
 
-    // Read the output value from the output FIFO. Since it takes fftSize
-    // timesteps before actual samples are read from this FIFO instead of
-    // the initial zeros, the sound output is delayed by fftSize samples,
-    // which we will report as our latency.
-    float outputSample = outputFifo[pos];
+    // The buffers only grow, a host going back and forth between layouts doesn't reallocate.
+    numChannels = juce::jlimit(1, maxChannels, numChannels);
+    if (numChannels > preparedChannels) {
+        inputFifo.resize(size_t(numChannels));
+        outputFifo.resize(size_t(numChannels));
+        frozenMagnitudes.resize(size_t(numChannels));
+        aggregatedSpectrum.resize(size_t(numChannels));
+        preparedChannels = numChannels;
+    }
 
-    // Once we've read the sample, set this position in the FIFO back to
-    // zero so we can add the IFFT results to it later.
-    outputFifo[pos] = 0.0f;
+    sampleRate = newSampleRate;
+    oscManager.setSampleRate(sampleRate);
 
-    // Advance the FIFO index and wrap around if necessary.
-    pos += 1;
-    if (pos == fftSize) {
-        pos = 0;
+    // The tilt gains depend on the bin frequencies.
+    tiltGainsNumBins = 0;
+
+    reset();
+    updateFramesPerPublish();
+}
+
+void FFTProcessor::setPublishRate(float newPublishRateHz)
+{
+    publishRateHz = newPublishRateHz;
+    updateFramesPerPublish();
+}
+
+void FFTProcessor::updateFramesPerPublish()
+{
+    // A new spectrum is ready every hopSize samples: publish one every
+    // framesPerPublish of them, e.g. 172 frames/s at 44.1 kHz -> 60 spectra/s.
+    const double framesPerSecond = sampleRate / hopSize;
+    if (publishRateHz <= 0.0f) {
+        framesPerPublish = 1;
+    }
+    else {
+        framesPerPublish = juce::jmax(1, juce::roundToInt(framesPerSecond / publishRateHz));
     }
 
-    // Process the FFT frame once we've collected hopSize samples.
-    count += 1;
-    if (count == hopSize) {
-        count = 0;
-        processFrame(bypassed);
+    clearAggregation();
+}
+
+void FFTProcessor::setAggregation(SpectrumAggregation newAggregation)
+{
+    if (newAggregation == aggregation)
+        return;
+
+    aggregation = newAggregation;
+
+    clearAggregation();
+}
+
+void FFTProcessor::processBlock(float* const* channels, int numChannels, int numSamples, bool bypassed)
+{
+    if (fft == nullptr)
+        return;
+
+    applyPendingResolution();
+
+    numChannels = juce::jmin(numChannels, preparedChannels);
+    if (numChannels != activeChannels) {
+        activeChannels = numChannels;
+        clearAggregation();
     }
 
-    return outputSample;
+    // The FIFOs are handled one chunk at a time, each chunk running up to the next hop
+    // boundary. Since fftSize is a multiple of hopSize and pos advances together with
+    // count, pos % hopSize == count: a chunk never wraps around the end of the FIFOs.
+    int start = 0;
+    while (start < numSamples) {
+        jassert(pos % hopSize == count);
+        const int chunkLength = juce::jmin(numSamples - start, hopSize - count);
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            float* data = channels[channel] + start;
+            float* output = outputFifo[channel].data() + pos;
+
+            // Push the new samples into the input FIFO.
+            juce::FloatVectorOperations::copy(inputFifo[channel].data() + pos, data, chunkLength);
+
+            // Read the output values from the output FIFO. Since it takes fftSize
+            // timesteps before actual samples are read from this FIFO instead of
+            // the initial zeros, the sound output is delayed by fftSize samples,
+            // which we will report as our latency.
+            juce::FloatVectorOperations::copy(data, output, chunkLength);
+
+            // Once we've read the samples, set these positions in the FIFO back to
+            // zero so we can add the IFFT results to them later.
+            juce::FloatVectorOperations::clear(output, chunkLength);
+        }
+
+        // Advance the FIFO index and wrap around if necessary.
+        pos += chunkLength;
+        if (pos == fftSize) {
+            pos = 0;
+        }
+
+        // Process the FFT frames once we've collected hopSize samples.
+        count += chunkLength;
+        if (count == hopSize) {
+            count = 0;
+            processFrame(numChannels, bypassed);
+        }
+
+        start += chunkLength;
+    }
 }
 
-void FFTProcessor::processFrame(bool bypassed)
+void FFTProcessor::processFrame(int numChannels, bool bypassed)
 {
-    const float* inputPtr = inputFifo.data();
     float* fftPtr = fftData.data();
 
-    // Copy the input FIFO into the FFT working space in two parts.
-    std::memcpy(fftPtr, inputPtr + pos, (fftSize - pos) * sizeof(float));
-    if (pos > 0) {
-        std::memcpy(fftPtr + fftSize - pos, inputPtr, pos * sizeof(float));
+    // All the channels go through the same FFT and window table back to back,
+    // so the tables stay in cache for the whole batch.
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const float* inputPtr = inputFifo[channel].data();
+        float* outputPtr = outputFifo[channel].data();
+
+        // Copy the input FIFO into the FFT working space in two parts.
+        std::memcpy(fftPtr, inputPtr + pos, (fftSize - pos) * sizeof(float));
+        if (pos > 0) {
+            std::memcpy(fftPtr + fftSize - pos, inputPtr, pos * sizeof(float));
+        }
+
+        // Apply the window to avoid spectral leakage.
+        juce::FloatVectorOperations::multiply(fftPtr, window, fftSize);
+
+        if (!bypassed && (publishing || spectralProcessing)) {
+            // Perform the forward FFT on a copy, so the windowed frame is still
+            // there for resynthesis when the spectrum is not modified.
+            float* spectrumPtr = spectrumData.data();
+            std::memcpy(spectrumPtr, fftPtr, fftSize * sizeof(float));
+            fft->performRealOnlyForwardTransform(spectrumPtr, true);
+
+            if (publishing) {
+                for (int i = 0; i < numBins; ++i) {
+                    const float re = spectrumPtr[2 * i];
+                    const float im = spectrumPtr[2 * i + 1];
+                    binMagnitudes[i] = std::sqrt(re * re + im * im);
+                }
+                aggregateSpectrum(channel, binMagnitudes.data());
+            }
+
+            if (spectralProcessing) {
+                processSpectrum(channel, spectrumPtr, numBins);
+                fft->performRealOnlyInverseTransform(spectrumPtr);
+                std::memcpy(fftPtr, spectrumPtr, fftSize * sizeof(float));
+            }
+        }
+
+        // Apply the window again for resynthesis.
+        juce::FloatVectorOperations::multiply(fftPtr, window, fftSize);
+
+        // Scale down the output samples because of the overlapping windows.
+        juce::FloatVectorOperations::multiply(fftPtr, windowCorrection, fftSize);
+
+        // Add the IFFT results to the output FIFO.
+        juce::FloatVectorOperations::add(outputPtr, fftPtr + fftSize - pos, pos);
+        juce::FloatVectorOperations::add(outputPtr + pos, fftPtr, fftSize - pos);
+    }
+
+    if (!bypassed && publishing) {
+        //Send spectra via OSC, at most once every framesPerPublish frames
+        aggregatedFrames += 1;
+        if (aggregatedFrames >= framesPerPublish) {
+            publishSpectra(numChannels);
+        }
     }
+}
 
-    // Apply the window to avoid spectral leakage.
-    window.multiplyWithWindowingTable(fftPtr, fftSize);
+void FFTProcessor::setSpectrumEncoding(SpectrumEncoding encoding, bool useDeltaEncoding)
+{
+    oscManager.setEncoding(encoding, useDeltaEncoding);
+}
 
-    if (!bypassed) {
-        // Perform the forward FFT.
-        fft.performFrequencyOnlyForwardTransform(fftPtr, true);
+void FFTProcessor::setInstanceId(int instanceId)
+{
+    oscManager.setInstanceId(instanceId);
+}
 
-        //Send spectrum via OSC
-        oscManager.sendSpectrum(fftPtr, fftSize);
+void FFTProcessor::aggregateSpectrum(int channel, const float* magnitudes)
+{
+    float* aggregated = aggregatedSpectrum[channel].data();
+
+    if (aggregation == SpectrumAggregation::peakHold) {
+        juce::FloatVectorOperations::max(aggregated, aggregated, magnitudes, numBins);
+    }
+    else {
+        juce::FloatVectorOperations::addWithMultiply(aggregated, magnitudes, magnitudes, numBins);
     }
+}
+
+void FFTProcessor::publishSpectra(int numChannels)
+{
+    for (int channel = 0; channel < numChannels; ++channel) {
+        float* aggregated = aggregatedSpectrum[channel].data();
 
-    // Apply the window again for resynthesis.
-    window.multiplyWithWindowingTable(fftPtr, fftSize);
+        if (aggregation == SpectrumAggregation::rms) {
+            juce::FloatVectorOperations::multiply(aggregated, 1.0f / float(aggregatedFrames), numBins);
+            for (int i = 0; i < numBins; ++i) {
+                aggregated[i] = std::sqrt(aggregated[i]);
+            }
+        }
 
-    // Scale down the output samples because of the overlapping windows.
-    for (int i = 0; i < fftSize; ++i) {
-        fftPtr[i] *= windowCorrection;
+        // Only the first numBins magnitudes are meaningful, the rest is the mirrored half.
+        oscManager.sendSpectrum(aggregated, numBins, channel);
+        if (channel == 0)
+            pushFrame(aggregated);
     }
 
-    // Add the IFFT results to the output FIFO.
-    for (int i = 0; i < pos; ++i) {
-        outputFifo[i] += fftData[i + fftSize - pos];
+    clearAggregation();
+}
+
+void FFTProcessor::pushFrame(const float* magnitudes)
+{
+    const auto scope = frameFifo.write(1);
+    if (scope.blockSize1 > 0) {
+        Frame& frame = queuedFrames[scope.startIndex1];
+        frame.numBins = numBins;
+        frame.sampleRate = sampleRate;
+        juce::FloatVectorOperations::copy(frame.magnitudes.data(), magnitudes, numBins);
     }
-    for (int i = 0; i < fftSize - pos; ++i) {
-        outputFifo[i + pos] += fftData[i];
+}
+
+bool FFTProcessor::popFrame(Frame& frame)
+{
+    const auto scope = frameFifo.read(1);
+    if (scope.blockSize1 > 0) {
+        const Frame& queued = queuedFrames[scope.startIndex1];
+        frame.numBins = queued.numBins;
+        frame.sampleRate = queued.sampleRate;
+        juce::FloatVectorOperations::copy(frame.magnitudes.data(), queued.magnitudes.data(), queued.numBins);
+        return true;
     }
+    return false;
+}
+
+void FFTProcessor::setParameters(const juce::AudioProcessorValueTreeState& apvts)
+{
+    parameters.gateThresholdDb = apvts.getRawParameterValue("spectral_gate")->load();
+    parameters.gateReductionDb = apvts.getRawParameterValue("spectral_reduction")->load();
+    parameters.freeze = apvts.getRawParameterValue("spectral_freeze")->load() > 0.5f;
+    parameters.tiltDbPerOctave = apvts.getRawParameterValue("spectral_tilt")->load();
+}
 
+void FFTProcessor::updateTiltGains()
+{
+    if (tiltGainsDbPerOctave == parameters.tiltDbPerOctave && tiltGainsNumBins == numBins)
+        return;
+
+    tiltGainsDbPerOctave = parameters.tiltDbPerOctave;
+    tiltGainsNumBins = numBins;
 
+    // Gain of each bin for a constant slope in dB/octave around tiltPivotHz.
+    // The DC bin gets the gain of 20 Hz, so it doesn't explode.
+    const float binWidth = float(sampleRate) / float(fftSize);
+    for (int i = 0; i < numBins; ++i) {
+        const float frequency = juce::jmax(20.0f, float(i) * binWidth);
+        const float octaves = std::log2(frequency / tiltPivotHz);
+        tiltGains[i] = juce::Decibels::decibelsToGain(tiltGainsDbPerOctave * octaves, -200.0f);
+    }
 }
 
-void FFTProcessor::processSpectrum(float* data, int numBins)
+void FFTProcessor::processSpectrum(int channel, float* data, int numBins)
 {
-    // The spectrum data is floats organized as [re, im, re, im, ...]
-    // but it's easier to deal with this as std::complex values.
-    auto* cdata = reinterpret_cast<std::complex<float>*>(data);
+    // The spectrum data is floats organized as [re, im, re, im, ...].
+    // Every effect is expressed as a real gain per bin and applied to re and im
+    // directly, so there is no need to go through std::arg and std::polar:
+    // the phase of each bin is left untouched.
+    float* power = binPower.data();
+    float* gain = binGain.data();
 
     for (int i = 0; i < numBins; ++i) {
-        // Usually we want to work with the magnitude and phase rather
-        // than the real and imaginary parts directly.
-        float magnitude = std::abs(cdata[i]);
-        float phase = std::arg(cdata[i]);
+        const float re = data[2 * i];
+        const float im = data[2 * i + 1];
+        power[i] = re * re + im * im;
+    }
+    juce::FloatVectorOperations::fill(gain, 1.0f, numBins);
 
-        // This is where you'd do your spectral processing...
+    // Freeze: keep the phases of the incoming frame but impose the magnitudes
+    // captured in the first frame after freeze was engaged.
+    float* frozen = frozenMagnitudes[channel].data();
+    if (parameters.freeze) {
+        if (!frozenCaptured[channel]) {
+            for (int i = 0; i < numBins; ++i) {
+                frozen[i] = std::sqrt(power[i]);
+            }
+            frozenCaptured[channel] = true;
+        }
+        else {
+            for (int i = 0; i < numBins; ++i) {
+                gain[i] = frozen[i] / std::sqrt(power[i] + 1.0e-20f);
+                power[i] = frozen[i] * frozen[i];
+            }
+        }
+    }
+    else {
+        frozenCaptured[channel] = false;
+    }
 
-        // Silly example where we change the phase of each frequency bin
-        // somewhat randomly. Uncomment the following line to enable.
-        //phase *= float(i);
+    // Gate: a full scale sine with a Hann window peaks at fftSize / 4, so that is 0 dBFS.
+    // The comparison is done on the squared magnitudes to avoid a square root per bin.
+    if (parameters.gateThresholdDb > -100.0f) {
+        const float threshold = 0.25f * float(fftSize) * juce::Decibels::decibelsToGain(parameters.gateThresholdDb);
+        const float thresholdPower = threshold * threshold;
+        const float reduction = juce::Decibels::decibelsToGain(parameters.gateReductionDb);
+        for (int i = 0; i < numBins; ++i) {
+            gain[i] *= power[i] < thresholdPower ? reduction : 1.0f;
+        }
+    }
 
-        // Convert magnitude and phase back into a complex number.
-        cdata[i] = std::polar(magnitude, phase);
+    // Tilt
+    if (parameters.tiltDbPerOctave != 0.0f) {
+        updateTiltGains();
+        juce::FloatVectorOperations::multiply(gain, tiltGains.data(), numBins);
+    }
+
+    for (int i = 0; i < numBins; ++i) {
+        data[2 * i] *= gain[i];
+        data[2 * i + 1] *= gain[i];
     }
 }
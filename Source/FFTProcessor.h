@@ -3,39 +3,136 @@
 #include <JuceHeader.h>
 #include "OscManager.h"
 
+struct SpectralParameters {
+    float gateThresholdDb;      // bins quieter than this (dBFS) are attenuated
+    float gateReductionDb;      // attenuation of the gated bins
+    bool freeze;                // hold the magnitudes captured when freeze was engaged
+    float tiltDbPerOctave;      // spectral slope around tiltPivotHz
+};
+
 /**
   STFT analysis and resynthesis of audio data.
 
-  Each channel should have its own FFTProcessor.
+  Up to maxChannels channels are processed in lockstep: they share the FFT
+  and the window table, and their frames are computed one after the other
+  at the same hop boundaries.
+
+  Nothing large is built by the constructor: the FFTs and window tables are
+  shared by all the instances and built by the first prepare(), and the FIFOs
+  are allocated by prepare() for the channels actually used.
  */
 class FFTProcessor
 {
 public:
+    // How the spectra computed between two publications are combined.
+    enum class SpectrumAggregation
+    {
+        peakHold,   // keep the largest magnitude of each bin, so transients survive
+        rms         // root mean square of each bin over the aggregated frames
+    };
+
+    // At least as many as the plugin accepts (see kMaxChannels). The analyser only uses two of them.
+    static constexpr int maxChannels = 16;
+
+    // Supported resolutions: FFT orders 9 to 13 (512 to 8192 points), overlaps 4 or 8.
+    // The Hann window is applied twice, and the squared window only adds up to a
+    // constant with at least 3 overlapping frames: 50% overlap would modulate the
+    // output at the hop rate.
+    static constexpr int minFftOrder = 9;
+    static constexpr int maxFftOrder = 13;
+    static constexpr int numFftOrders = maxFftOrder - minFftOrder + 1;
+
+    // A published spectrum, as read by the analyser in the editor.
+    struct Frame
+    {
+        int numBins = 0;
+        double sampleRate = 44100.0;
+        std::array<float, (1 << maxFftOrder) / 2 + 1> magnitudes;
+    };
+
     FFTProcessor();
 
     int getLatencyInSamples() const { return fftSize; }
 
+    // Allocates the FIFOs for numChannels channels (at most maxChannels).
+    void prepare(double sampleRate, int numChannels);
     void reset();
-    float processSample(float sample, bool bypassed);
-    void processBlock(float* data, int numSamples, bool bypassed);
 
+    // Processes numChannels (at most the number given to prepare()) channels in place.
+    // Does nothing before prepare().
+    void processBlock(float* const* channels, int numChannels, int numSamples, bool bypassed);
 
-private:
-    void processFrame(bool bypassed);
-    void processSpectrum(float* data, int numBins);
+    // Limits how many spectra per second are sent via OSC. The frames computed in
+    // between are aggregated, so nothing is allocated on the audio thread.
+    void setPublishRate(float publishRateHz);
 
-    // The FFT has 2^order points and fftSize/2 + 1 bins.
-    static constexpr int fftOrder = 10;
-    static constexpr int fftSize = 1 << fftOrder;      // 1024 samples
-    static constexpr int numBins = fftSize / 2 + 1;    // 513 bins
-    static constexpr int overlap = 4;                  // 75% overlap
-    static constexpr int hopSize = fftSize / overlap;  // 256 samples
+    // Restarts the aggregation when the mode changes. Same thread as processBlock.
+    void setAggregation(SpectrumAggregation newAggregation);
+    void setSpectrumEncoding(SpectrumEncoding encoding, bool useDeltaEncoding);
+    void setInstanceId(int instanceId);
 
-    // Gain correction for using Hann window with 75% overlap.
-    static constexpr float windowCorrection = 2.0f / 3.0f;
+    // Selects the FFT order and overlap. Can be called from any thread: the switch
+    // happens at the start of the next processBlock, using the FFTs and window
+    // tables built by prepare(), so the audio thread never allocates.
+    // Returns false if the combination is not supported.
+    bool setResolution(int newFftOrder, int newOverlap);
 
-    juce::dsp::FFT fft;
-    juce::dsp::WindowingFunction<float> window;
+    // The analyser publishes spectra and leaves the audio untouched. The effect stage
+    // disables publishing and enables the spectral processing of processSpectrum().
+    void setPublishing(bool shouldPublish) { publishing = shouldPublish; }
+    void setSpectralProcessing(bool shouldProcess) { spectralProcessing = shouldProcess; }
+    void setParameters(const juce::AudioProcessorValueTreeState& apvts);
+
+    // Reads the oldest published spectrum (channel 0) not read yet. Lock-free, must always
+    // be called from the same thread (the editor timer). Returns false if there is none.
+    bool popFrame(Frame& frame);
+
+private:
+    void processFrame(int numChannels, bool bypassed);
+    void processSpectrum(int channel, float* data, int numBins);
+    void updateTiltGains();
+    void aggregateSpectrum(int channel, const float* magnitudes);
+    void publishSpectra(int numChannels);
+    void clearAggregation();
+    void pushFrame(const float* magnitudes);
+    void applyPendingResolution();
+    void updateFramesPerPublish();
+
+    static constexpr int maxFftSize = 1 << maxFftOrder;
+    static constexpr int maxNumBins = maxFftSize / 2 + 1;
+
+    // The FFT has 2^order points and fftSize/2 + 1 bins.
+    int fftOrder = 10;
+    int fftSize = 1 << 10;              // 1024 samples
+    int numBins = fftSize / 2 + 1;      // 513 bins
+    int overlap = 4;                    // 75% overlap
+    int hopSize = fftSize / overlap;    // 256 samples
+
+    // Gain correction for using a Hann window twice: the squared windows
+    // add up to 3/8 * overlap, i.e. 2/3 with 75% overlap.
+    float windowCorrection = 2.0f / 3.0f;
+
+    // Requested resolution, packed as order * 16 + overlap, applied by the audio thread.
+    std::atomic<int> pendingResolution{ 10 * 16 + 4 };
+
+    // One FFT and one periodic Hann window per supported order, built once per
+    // process and only read afterwards, so every instance uses the same ones.
+    struct Tables
+    {
+        Tables();
+
+        std::array<std::unique_ptr<juce::dsp::FFT>, numFftOrders> ffts;
+        std::array<std::vector<float>, numFftOrders> windowTables;
+    };
+
+    // Built by the first call and kept until the process exits, so a host that creates
+    // and destroys instances one after the other doesn't build them every time.
+    static const Tables& getTables();
+
+    // Null until the first prepare()
+    const Tables* tables = nullptr;
+    juce::dsp::FFT* fft = nullptr;
+    const float* window = nullptr;
 
     // Counts up until the next hop.
     int count = 0;
@@ -43,14 +140,56 @@ private:
     // Write position in input FIFO and read position in output FIFO.
     int pos = 0;
 
-    // Circular buffers for incoming and outgoing audio data.
-    std::array<float, fftSize> inputFifo;
-    std::array<float, fftSize> outputFifo;
+    // Circular buffers for incoming and outgoing audio data, one per prepared channel.
+    // They are sized for the largest FFT, only the first fftSize samples are used.
+    std::vector<std::array<float, maxFftSize>> inputFifo;
+    std::vector<std::array<float, maxFftSize>> outputFifo;
 
     // The FFT working space. Contains interleaved complex numbers.
-    std::array<float, fftSize * 2> fftData;
+    std::array<float, maxFftSize * 2> fftData;
+    std::array<float, maxFftSize * 2> spectrumData;
+
+    // Per-bin scratch space for the magnitude math.
+    std::array<float, maxNumBins> binMagnitudes;
+    std::array<float, maxNumBins> binPower;
+    std::array<float, maxNumBins> binGain;
+
+    bool publishing = true;
+    bool spectralProcessing = false;
+
+    // Spectral effects state.
+    SpectralParameters parameters{ -100.0f, -30.0f, false, 0.0f };
+    static constexpr float tiltPivotHz = 1000.0f;
+    std::vector<std::array<float, maxNumBins>> frozenMagnitudes;
+    std::array<bool, maxChannels> frozenCaptured{};
+    std::array<float, maxNumBins> tiltGains;
+    float tiltGainsDbPerOctave = 0.0f;
+    int tiltGainsNumBins = 0;
+
+    // Spectra aggregated since the last publication, and how many frames they hold.
+    std::vector<std::array<float, maxNumBins>> aggregatedSpectrum;
+    int aggregatedFrames = 0;
+
+    // Number of channels in the previous block, the aggregation restarts when it changes.
+    int activeChannels = 0;
+
+    // Number of channels the buffers were allocated for by prepare().
+    int preparedChannels = 0;
+
+    // Number of FFT frames combined into one published spectrum.
+    double sampleRate = 44100.0;
+    float publishRateHz = 0.0f;
+    int framesPerPublish = 1;
+    SpectrumAggregation aggregation = SpectrumAggregation::peakHold;
 
     OscManager oscManager;
 
+    // Published spectra waiting for the editor, up to numQueuedFrames. If nobody reads
+    // them the FIFO fills up and the new frames are dropped. An AbstractFifo of size N
+    // holds N - 1 items, hence the extra slot.
+    static constexpr int numQueuedFrames = 4;
+    juce::AbstractFifo frameFifo{ numQueuedFrames + 1 };
+    std::array<Frame, numQueuedFrames + 1> queuedFrames;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FFTProcessor)
 };
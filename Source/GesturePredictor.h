@@ -0,0 +1,157 @@
+/*
+  This class predicts where a gesture is going, to make up for the lag between the sensor
+  and the parameter: the serial or network transport, the queue read by the editor timer
+  and the audio block. Every value of one axis of one controller goes through its own
+  predictor, on the sensor thread, and comes out projected leadMs into the future.
+
+  Two predictors are available:
+    linear:     extrapolates the velocity between the samples, low-passed over
+                velocityTimeConstantMs: the values are whole steps from 0 to 100 and can be
+                0.25 ms apart, so the raw difference of two samples jumps around
+    alphaBeta:  tracks position and velocity with an alpha-beta filter, which is less
+                thrown off by the noise of the sensor than the linear extrapolation
+
+  Every prediction is checked against the sample that comes in when its time is reached.
+  The errors are gathered in PredictionErrors along with the error of not predicting at
+  all (the value at the time of the prediction), so the benefit can be measured.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Predictors in the order of predictionModes
+enum class PredictionMode
+{
+    off,
+    linear,
+    alphaBeta
+};
+
+// Mean square errors of the predictions of one controller, written by the sensor
+// thread only and readable from any thread
+struct PredictionErrors {
+    std::atomic<float> meanSquare{ 0.0f };
+    std::atomic<float> baselineMeanSquare{ 0.0f };
+    std::atomic<uint32_t> count{ 0 };
+
+    void add(float error, float baselineError)
+    {
+        // Average over the last few hundred predictions
+        const float weight = juce::jmax(0.005f, 1.0f / float(count + 1));
+        meanSquare = meanSquare + weight * (error * error - meanSquare);
+        baselineMeanSquare = baselineMeanSquare + weight * (baselineError * baselineError - baselineMeanSquare);
+        count++;
+    }
+
+    void reset()
+    {
+        meanSquare = 0.0f;
+        baselineMeanSquare = 0.0f;
+        count = 0;
+    }
+};
+
+class GesturePredictor {
+
+public:
+    static inline const juce::StringArray predictionModes{ "Off", "Linear", "Alpha-Beta" };
+
+    // Takes the sample `value` of the gesture at `timeMs` and returns its prediction leadMs
+    // later. The predictions are checked once the gesture gets there: at evaluationLeadMs,
+    // the whole lag of the chain, whatever part of it is predicted.
+    float process(float value, double timeMs, PredictionMode mode, float leadMs, float evaluationLeadMs, PredictionErrors& errors)
+    {
+        // After a pause (e.g. the hand back at rest, below the tilt threshold) start again
+        if (!hasSample || timeMs - lastTime > maxGapMs) {
+            hasSample = true;
+            position = lastValue = value;
+            velocity = 0.0f;
+            lastTime = timeMs;
+            numPending = 0;
+            queue(timeMs + evaluationLeadMs, value, value);
+            return value;
+        }
+
+        // Samples read together can share a time
+        const float dt = float(juce::jmax(timeMs - lastTime, minStepMs));
+        evaluate(timeMs, value, errors);
+
+        switch (mode)
+        {
+        case PredictionMode::linear:
+        {
+            // The weight follows dt, so the smoothing is the same at any sample rate
+            const float weight = 1.0f - std::exp(-dt / velocityTimeConstantMs);
+            velocity += weight * ((value - lastValue) / dt - velocity);
+            position = value;
+            break;
+        }
+        case PredictionMode::alphaBeta:
+        case PredictionMode::off:
+        {
+            // The filter also runs while off, so switching it on doesn't start from scratch
+            const float predicted = position + velocity * dt;
+            const float residual = value - predicted;
+            position = predicted + alpha * residual;
+            velocity += beta * residual / dt;
+            break;
+        }
+        }
+
+        lastTime = timeMs;
+        lastValue = value;
+
+        const float output = mode == PredictionMode::off ? value
+                           : juce::jlimit(-maxValue, maxValue, position + velocity * leadMs);
+        queue(timeMs + evaluationLeadMs, output, value);
+        return output;
+    }
+
+private:
+    static constexpr double maxGapMs = 100.0;
+    static constexpr double minStepMs = 0.25;
+    static constexpr float maxValue = 100.0f;
+    static constexpr float alpha = 0.5f;
+    static constexpr float beta = 0.1f;
+    static constexpr float velocityTimeConstantMs = 10.0f;
+
+    bool hasSample{ false };
+    double lastTime{ 0.0 };
+    float lastValue{ 0.0f };
+    float position{ 0.0f };
+    float velocity{ 0.0f };   // per ms
+
+    // Predictions waiting for the gesture to reach their time, oldest first
+    struct Pending {
+        double time;
+        float predicted;
+        float unpredicted;
+    };
+    static constexpr int maxPending = 128;
+    std::array<Pending, maxPending> pending;
+    int numPending{ 0 };
+
+    void queue(double time, float predicted, float unpredicted)
+    {
+        if (numPending == maxPending) {
+            std::copy(pending.begin() + 1, pending.end(), pending.begin());
+            numPending--;
+        }
+        pending[static_cast<size_t>(numPending++)] = { time, predicted, unpredicted };
+    }
+
+    void evaluate(double timeMs, float value, PredictionErrors& errors)
+    {
+        int done = 0;
+        while (done < numPending && pending[static_cast<size_t>(done)].time <= timeMs) {
+            const auto& prediction = pending[static_cast<size_t>(done)];
+            errors.add(value - prediction.predicted, value - prediction.unpredicted);
+            done++;
+        }
+        if (done > 0) {
+            std::copy(pending.begin() + done, pending.begin() + numPending, pending.begin());
+            numPending -= done;
+        }
+    }
+};
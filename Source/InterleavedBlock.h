@@ -0,0 +1,78 @@
+/*
+  This class packs the channels of an AudioBlock into groups of SIMDRegister<float>::size()
+  channels (4 with SSE/NEON), so that a single filter or shaper processes all the channels
+  of a group at once, one SIMD lane per channel. Channel c goes to lane c % lanes of group
+  c / lanes; the lanes left over in the last group are kept at zero.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class InterleavedBlock
+{
+public:
+    using Register = juce::dsp::SIMDRegister<float>;
+    static constexpr int lanes = static_cast<int>(Register::SIMDNumElements);
+
+    void prepare(int nChannels, int maxBlockSize)
+    {
+        numChannels = nChannels;
+        maxSamples = maxBlockSize;
+        numGroups = (numChannels + lanes - 1) / lanes;
+
+        block = juce::dsp::AudioBlock<Register>(data, static_cast<size_t>(juce::jmax(1, numGroups)), static_cast<size_t>(maxSamples));
+        for (int group = 0; group < numGroups; ++group)
+            std::fill(getRawGroup(group), getRawGroup(group) + maxSamples * lanes, 0.0f);
+    }
+
+    int getNumGroups() const { return numGroups; }
+
+    // Copies the channels of source into the lanes.
+    void interleave(const juce::dsp::AudioBlock<float>& source)
+    {
+        const int numSamples = static_cast<int>(source.getNumSamples());
+        const int sourceChannels = juce::jmin(numChannels, static_cast<int>(source.getNumChannels()));
+        jassert(numSamples <= maxSamples);
+
+        for (int channel = 0; channel < sourceChannels; ++channel) {
+            const float* src = source.getChannelPointer(static_cast<size_t>(channel));
+            float* dest = getRawGroup(channel / lanes) + channel % lanes;
+            for (int i = 0; i < numSamples; ++i)
+                dest[i * lanes] = src[i];
+        }
+    }
+
+    // Copies the lanes back into the channels of dest.
+    void deinterleave(juce::dsp::AudioBlock<float>& dest) const
+    {
+        const int numSamples = static_cast<int>(dest.getNumSamples());
+        const int destChannels = juce::jmin(numChannels, static_cast<int>(dest.getNumChannels()));
+
+        for (int channel = 0; channel < destChannels; ++channel) {
+            const float* src = getRawGroup(channel / lanes) + channel % lanes;
+            float* out = dest.getChannelPointer(static_cast<size_t>(channel));
+            for (int i = 0; i < numSamples; ++i)
+                out[i] = src[i * lanes];
+        }
+    }
+
+    // One group of channels as a block of SIMD registers, for the juce::dsp processors.
+    juce::dsp::AudioBlock<Register> getGroup(int group, int numSamples)
+    {
+        return block.getSubsetChannelBlock(static_cast<size_t>(group), 1).getSubBlock(0, static_cast<size_t>(numSamples));
+    }
+
+    // The same group as numSamples * lanes contiguous floats, for sample-wise processing
+    // that the compiler can vectorise (e.g. the waveshaper, which needs a division).
+    float* getRawGroup(int group) { return reinterpret_cast<float*>(block.getChannelPointer(static_cast<size_t>(group))); }
+    const float* getRawGroup(int group) const { return reinterpret_cast<const float*>(block.getChannelPointer(static_cast<size_t>(group))); }
+
+private:
+    int numChannels = 0;
+    int maxSamples = 0;
+    int numGroups = 0;
+
+    juce::HeapBlock<char> data;
+    juce::dsp::AudioBlock<Register> block;
+};
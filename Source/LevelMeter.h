@@ -0,0 +1,284 @@
+/*
+  Level meters for gain staging. A LevelMeter measures one point of the chain:
+  - peak: sample peak with a 20 dB/s fall, like a hardware PPM
+  - rms: unweighted RMS over the last 300 ms
+  - loudness: short-term loudness (K-weighted, last 3 s) in LUFS, as in ITU-R BS.1770
+
+  LevelMeters holds one meter for each MeterPoint. The audio thread measures the
+  points in EQAudioProcessor::processBlock() and publishes all the readings at the
+  end of the block through a seqlock, so the editor timer and the OSC publisher get a
+  consistent snapshot without locking and without ever blocking the audio thread.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Where the chain is metered, in processing order
+enum class MeterPoint
+{
+    input,
+    equalizer,
+    distortion,
+    spectral,
+    delay,
+    output
+};
+
+struct MeterReading {
+    float peakDb;
+    float rmsDb;
+    float loudness;
+};
+
+class LevelMeter {
+
+public:
+    static constexpr float minDb = -100.0f;
+
+    void prepare(double sampleRate, int maxBlockSize, int nChannels)
+    {
+        segmentLength = juce::jmax(1, juce::roundToInt(segmentSeconds * sampleRate));
+        fallPerSample = static_cast<float>(peakFallDbPerSecond / sampleRate);
+
+        weighted.setSize(1, maxBlockSize);
+
+        // K-weighting: high shelf for the head, then high pass (coefficients from BS.1770, any sample rate)
+        const double pi = juce::MathConstants<double>::pi;
+        double K = std::tan(pi * 1681.974450955533 / sampleRate);
+        const double Q1 = 0.7071752369554196;
+        const double Vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        const double Vb = std::pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q1 + K * K;
+        *shelfCoefficients = juce::dsp::IIR::Coefficients<float>(
+            static_cast<float>((Vh + Vb * K / Q1 + K * K) / a0), static_cast<float>(2.0 * (K * K - Vh) / a0), static_cast<float>((Vh - Vb * K / Q1 + K * K) / a0),
+            1.0f, static_cast<float>(2.0 * (K * K - 1.0) / a0), static_cast<float>((1.0 - K / Q1 + K * K) / a0));
+
+        K = std::tan(pi * 38.13547087602444 / sampleRate);
+        const double Q2 = 0.5003270373238773;
+        a0 = 1.0 + K / Q2 + K * K;
+        *highPassCoefficients = juce::dsp::IIR::Coefficients<float>(
+            1.0f, -2.0f, 1.0f,
+            1.0f, static_cast<float>(2.0 * (K * K - 1.0) / a0), static_cast<float>((1.0 - K / Q2 + K * K) / a0));
+
+        shelves.resize(static_cast<size_t>(nChannels));
+        highPasses.resize(static_cast<size_t>(nChannels));
+        for (int channel = 0; channel < nChannels; ++channel) {
+            shelves[channel].coefficients = shelfCoefficients;
+            highPasses[channel].coefficients = highPassCoefficients;
+        }
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto& filter : shelves)
+            filter.reset();
+        for (auto& filter : highPasses)
+            filter.reset();
+
+        peakDb = minDb;
+        segmentSamples = 0;
+        segmentSquares = 0.0;
+        segmentWeighted = 0.0;
+        squares.fill(0.0);
+        weightedSquares.fill(0.0);
+        segmentIndex = 0;
+    }
+
+    void measure(const juce::AudioBuffer<float>& buffer)
+    {
+        const int numChannels = juce::jmin(buffer.getNumChannels(), static_cast<int>(shelves.size()));
+        const int numSamples = buffer.getNumSamples();
+
+        float blockPeak = 0.0f;
+        double blockSquares = 0.0;
+        double blockWeighted = 0.0;
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            for (int start = 0; start < numSamples; start += weighted.getNumSamples()) {
+                const int length = juce::jmin(weighted.getNumSamples(), numSamples - start);
+                const float* samples = buffer.getReadPointer(channel, start);
+
+                const auto range = juce::FloatVectorOperations::findMinAndMax(samples, length);
+                blockPeak = juce::jmax(blockPeak, -range.getStart(), range.getEnd());
+                blockSquares += sumOfSquares(samples, length);
+
+                // BS.1770 sums the mean squares of the channels, all with weight 1 here
+                float* filtered = weighted.getWritePointer(0);
+                juce::FloatVectorOperations::copy(filtered, samples, length);
+                juce::dsp::AudioBlock<float> block(&filtered, 1, static_cast<size_t>(length));
+                juce::dsp::ProcessContextReplacing<float> context(block);
+                shelves[channel].process(context);
+                highPasses[channel].process(context);
+                blockWeighted += sumOfSquares(filtered, length);
+            }
+        }
+
+        // RMS over all the channels, loudness summed over the channels
+        if (numChannels > 0)
+            blockSquares /= numChannels;
+
+        advance(blockPeak, blockSquares, blockWeighted, numSamples);
+    }
+
+    // Lets the meter fall as if numSamples of silence were measured, without touching the signal
+    void measureSilence(int numSamples)
+    {
+        advance(0.0f, 0.0, 0.0, numSamples);
+    }
+
+    MeterReading getReading() const
+    {
+        double rms = 0.0;
+        for (int i = 0; i < rmsSegments; ++i)
+            rms += squares[(segmentIndex + numSegments - 1 - i) % numSegments];
+        rms /= static_cast<double>(rmsSegments) * segmentLength;
+
+        double loudness = 0.0;
+        for (double value : weightedSquares)
+            loudness += value;
+        loudness /= static_cast<double>(numSegments) * segmentLength;
+
+        return { peakDb,
+                 juce::jmax(minDb, static_cast<float>(10.0 * std::log10(rms + 1.0e-20))),
+                 juce::jmax(minDb, static_cast<float>(-0.691 + 10.0 * std::log10(loudness + 1.0e-20))) };
+    }
+
+private:
+    // The windows are built out of 100 ms segments: 3 for the RMS, 30 for the short-term loudness
+    static constexpr double segmentSeconds = 0.1;
+    static constexpr int rmsSegments = 3;
+    static constexpr int numSegments = 30;
+    static constexpr double peakFallDbPerSecond = 20.0;
+
+    int segmentLength{ 1 };
+    float fallPerSample{ 0.0f };
+
+    juce::dsp::IIR::Coefficients<float>::Ptr shelfCoefficients{ new juce::dsp::IIR::Coefficients<float>() };
+    juce::dsp::IIR::Coefficients<float>::Ptr highPassCoefficients{ new juce::dsp::IIR::Coefficients<float>() };
+    std::vector<juce::dsp::IIR::Filter<float>> shelves;
+    std::vector<juce::dsp::IIR::Filter<float>> highPasses;
+    juce::AudioBuffer<float> weighted;
+
+    float peakDb{ minDb };
+
+    // Sums of squares of the completed segments (ring buffers) and of the one being filled
+    std::array<double, numSegments> squares{};
+    std::array<double, numSegments> weightedSquares{};
+    int segmentIndex{ 0 };
+    int segmentSamples{ 0 };
+    double segmentSquares{ 0.0 };
+    double segmentWeighted{ 0.0 };
+
+    // Sum of squares with independent partial sums, so the compiler can keep them in a SIMD register
+    static double sumOfSquares(const float* samples, int numSamples)
+    {
+        std::array<float, 8> partial{};
+        int i = 0;
+        for (; i + 8 <= numSamples; i += 8)
+            for (int lane = 0; lane < 8; ++lane)
+                partial[lane] += samples[i + lane] * samples[i + lane];
+
+        double sum = 0.0;
+        for (float value : partial)
+            sum += value;
+        for (; i < numSamples; ++i)
+            sum += samples[i] * samples[i];
+        return sum;
+    }
+
+    void advance(float blockPeak, double blockSquares, double blockWeighted, int numSamples)
+    {
+        const float blockPeakDb = juce::Decibels::gainToDecibels(blockPeak, minDb);
+        peakDb = juce::jmax(blockPeakDb, peakDb - fallPerSample * numSamples, minDb);
+
+        // A block is accounted to the segment it ends in: fine for blocks much shorter than 100 ms
+        segmentSquares += blockSquares;
+        segmentWeighted += blockWeighted;
+        segmentSamples += numSamples;
+
+        while (segmentSamples >= segmentLength) {
+            squares[segmentIndex] = segmentSquares;
+            weightedSquares[segmentIndex] = segmentWeighted;
+            segmentIndex = (segmentIndex + 1) % numSegments;
+
+            segmentSamples -= segmentLength;
+            segmentSquares = 0.0;
+            segmentWeighted = 0.0;
+        }
+    }
+};
+
+class LevelMeters {
+
+public:
+    static constexpr int numPoints = static_cast<int>(MeterPoint::output) + 1;
+    using Readings = std::array<MeterReading, numPoints>;
+
+    void prepare(double sampleRate, int maxBlockSize, int nChannels)
+    {
+        for (auto& meter : meters)
+            meter.prepare(sampleRate, maxBlockSize, nChannels);
+        publish();
+    }
+
+    void measure(MeterPoint point, const juce::AudioBuffer<float>& buffer)
+    {
+        meters[static_cast<size_t>(point)].measure(buffer);
+    }
+
+    void measureSilence(int numSamples)
+    {
+        for (auto& meter : meters)
+            meter.measureSilence(numSamples);
+    }
+
+    // Audio thread only: publishes the readings of all the points at once
+    void publish()
+    {
+        const uint32_t version = sequence.load(std::memory_order_relaxed);
+        sequence.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < meters.size(); ++i) {
+            const MeterReading reading = meters[i].getReading();
+            published[i][0].store(reading.peakDb, std::memory_order_relaxed);
+            published[i][1].store(reading.rmsDb, std::memory_order_relaxed);
+            published[i][2].store(reading.loudness, std::memory_order_relaxed);
+        }
+
+        sequence.store(version + 2, std::memory_order_release);
+    }
+
+    // Any thread: copies the last published readings. Retries while the audio thread is
+    // writing, and gives up (returning false) if it keeps being interrupted.
+    bool read(Readings& readings) const
+    {
+        for (int attempt = 0; attempt < maxReadAttempts; ++attempt) {
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+            if (before & 1u)
+                continue;
+
+            for (size_t i = 0; i < readings.size(); ++i)
+                readings[i] = { published[i][0].load(std::memory_order_relaxed),
+                                published[i][1].load(std::memory_order_relaxed),
+                                published[i][2].load(std::memory_order_relaxed) };
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static constexpr int maxReadAttempts = 16;
+
+    std::array<LevelMeter, numPoints> meters;
+
+    // Odd while the audio thread is writing
+    std::atomic<uint32_t> sequence{ 0 };
+    std::array<std::array<std::atomic<float>, 3>, numPoints> published{};
+};
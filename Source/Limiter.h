@@ -0,0 +1,229 @@
+/*
+  This class implements the output stage: the smoothed output volume followed by a
+  look-ahead true-peak limiter. It contains functions to set the parameters and to
+  process the output audio. These functions are called from EQAudioProcessor::processBlock().
+
+  The true peak is detected on a 4x upsampled version of the signal, so inter-sample
+  peaks are caught too. The gain needed to keep the peak under the ceiling is held for
+  the look-ahead time and averaged over the same time, so it is already down when the
+  peak leaves the delay line. All channels share the same gain, to keep the stereo image.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+struct LimiterParameters {
+    float outputGainDb;
+    bool enabled;
+    float ceilingDb;
+};
+
+class Limiter {
+
+public:
+    static LimiterParameters readParameters(const juce::AudioProcessorValueTreeState& apvts)
+    {
+        LimiterParameters newParameters;
+        newParameters.outputGainDb = apvts.getRawParameterValue("out_volume")->load();
+        newParameters.enabled = apvts.getRawParameterValue("limiter_on")->load() > 0.5f;
+        newParameters.ceilingDb = apvts.getRawParameterValue("limiter_ceiling")->load();
+        return newParameters;
+    }
+
+    void setParameters(const juce::AudioProcessorValueTreeState& apvts)
+    {
+        setParameters(readParameters(apvts));
+    }
+
+    void setParameters(const LimiterParameters& newParameters)
+    {
+        parameters = newParameters;
+
+        outputGain.setTargetValue(juce::Decibels::decibelsToGain(parameters.outputGainDb, -100.0f));
+        ceiling = juce::Decibels::decibelsToGain(parameters.ceilingDb);
+    }
+
+    bool isEnabled() const { return parameters.enabled; }
+
+    // The gain for a sample is complete once the detector has seen both segments around it,
+    // which happens halfTaps - 2 samples after the look-ahead time because of the upsampling filter
+    int getLatencyInSamples() const { return lookahead + halfTaps - 2; }
+
+    void prepare(double sampleRate, int maxBlockSize, int nChannels)
+    {
+        this->maxBlockSize = maxBlockSize;
+        lookahead = juce::jmax(2 * halfTaps, juce::roundToInt(lookaheadSeconds * sampleRate));
+        releaseCoefficient = static_cast<float>(std::exp(-1.0 / (releaseSeconds * sampleRate)));
+
+        // Each channel keeps the last getLatencyInSamples() samples in front of the new block
+        delayLines.setSize(nChannels, getLatencyInSamples() + maxBlockSize);
+        gains.allocate(static_cast<size_t>(maxBlockSize), true);
+        peaks.allocate(static_cast<size_t>(maxBlockSize), true);
+        holdValues.allocate(static_cast<size_t>(lookahead + 1), true);
+        holdTimes.allocate(static_cast<size_t>(lookahead + 1), true);
+        averageWindow.allocate(static_cast<size_t>(lookahead), true);
+
+        makeInterpolator();
+
+        outputGain.reset(sampleRate, gainRampSeconds);
+        reset();
+    }
+
+    void reset()
+    {
+        delayLines.clear();
+
+        holdStart = 0;
+        holdCount = 0;
+        time = 0;
+
+        for (int i = 0; i < lookahead; ++i)
+            averageWindow[i] = 1.0f;
+        averagePosition = 0;
+        averageSum = lookahead;
+        envelope = 1.0f;
+
+        outputGain.setCurrentAndTargetValue(outputGain.getTargetValue());
+    }
+
+    void process(juce::AudioBuffer<float>& buffer)
+    {
+        const int numChannels = juce::jmin(buffer.getNumChannels(), delayLines.getNumChannels());
+
+        for (int start = 0; start < buffer.getNumSamples(); start += maxBlockSize) {
+            const int numSamples = juce::jmin(maxBlockSize, buffer.getNumSamples() - start);
+
+            for (int i = 0; i < numSamples; ++i)
+                gains[i] = outputGain.getNextValue();
+
+            if (!parameters.enabled) {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    juce::FloatVectorOperations::multiply(buffer.getWritePointer(channel, start), gains.get(), numSamples);
+                continue;
+            }
+
+            const int latency = getLatencyInSamples();
+
+            // The output volume is applied on the way into the delay lines, so the limiter
+            // sees the signal that actually leaves the plugin
+            juce::FloatVectorOperations::fill(peaks.get(), 0.0f, numSamples);
+            for (int channel = 0; channel < numChannels; ++channel) {
+                float* line = delayLines.getWritePointer(channel);
+                juce::FloatVectorOperations::multiply(line + latency, buffer.getReadPointer(channel, start), gains.get(), numSamples);
+                detectTruePeaks(line + latency, numSamples);
+            }
+
+            computeGains(numSamples);
+
+            // Gain reduction on the delayed signal, then keep the tail of the line for the next block
+            for (int channel = 0; channel < numChannels; ++channel) {
+                float* line = delayLines.getWritePointer(channel);
+                juce::FloatVectorOperations::multiply(buffer.getWritePointer(channel, start), line, gains.get(), numSamples);
+                std::memmove(line, line + numSamples, sizeof(float) * static_cast<size_t>(latency));
+            }
+        }
+    }
+
+private:
+    static constexpr double lookaheadSeconds = 0.0015;
+    static constexpr double releaseSeconds = 0.1;
+    static constexpr double gainRampSeconds = 0.05;
+
+    // 4x upsampling with a windowed sinc, halfTaps samples on each side of the interpolated point
+    static constexpr int oversampling = 4;
+    static constexpr int halfTaps = 6;
+
+    LimiterParameters parameters{ -12.0f, false, -1.0f };
+    float ceiling{ 1.0f };
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Multiplicative> outputGain{ 1.0f };
+
+    int maxBlockSize{ 0 };
+    int lookahead{ 1 };
+    float releaseCoefficient{ 0.0f };
+
+    juce::AudioBuffer<float> delayLines;
+    juce::HeapBlock<float> gains;
+    juce::HeapBlock<float> peaks;
+
+    // Coefficients of the oversampling phases 1..3, phase 0 being the sample itself
+    std::array<std::array<float, 2 * halfTaps>, oversampling - 1> interpolator{};
+
+    // Sliding minimum of the wanted gain over lookahead + 1 samples (monotonic queue)
+    juce::HeapBlock<float> holdValues;
+    juce::HeapBlock<juce::int64> holdTimes;
+    int holdStart{ 0 };
+    int holdCount{ 0 };
+    juce::int64 time{ 0 };
+
+    // Moving average of the held gain over lookahead samples
+    juce::HeapBlock<float> averageWindow;
+    int averagePosition{ 0 };
+    double averageSum{ 0.0 };
+    float envelope{ 1.0f };
+
+    void makeInterpolator()
+    {
+        for (int phase = 1; phase < oversampling; ++phase) {
+            const double fraction = static_cast<double>(phase) / oversampling;
+            for (int tap = 0; tap < 2 * halfTaps; ++tap) {
+                // Distance from the interpolated point to sample (tap - halfTaps + 1)
+                const double x = fraction - (tap - halfTaps + 1);
+                const double sinc = x == 0.0 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+                const double window = 0.5 * (1.0 + std::cos(juce::MathConstants<double>::pi * x / (halfTaps + 1)));
+                interpolator[phase - 1][tap] = static_cast<float>(sinc * window);
+            }
+        }
+    }
+
+    // Writes into peaks[] the largest upsampled magnitude on the segment between the two
+    // samples at the centre of the filter window, which ends at each new sample. The
+    // samples before `input` are the tail of the delay line, so no history is needed.
+    void detectTruePeaks(const float* input, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i) {
+            const float* window = input + i - 2 * halfTaps + 1;
+            float peak = juce::jmax(std::abs(window[halfTaps - 1]), std::abs(window[halfTaps]));
+            for (const auto& coefficients : interpolator) {
+                float value = 0.0f;
+                for (int tap = 0; tap < 2 * halfTaps; ++tap)
+                    value += coefficients[tap] * window[tap];
+                peak = juce::jmax(peak, std::abs(value));
+            }
+            peaks[i] = juce::jmax(peaks[i], peak);
+        }
+    }
+
+    // Turns peaks[] into the gain for the samples leaving the delay lines. The output
+    // volume is already in the delay lines, so gains[] is overwritten.
+    void computeGains(int numSamples)
+    {
+        const int holdSize = lookahead + 1;
+
+        for (int i = 0; i < numSamples; ++i, ++time) {
+            const float wanted = peaks[i] > ceiling ? ceiling / peaks[i] : 1.0f;
+
+            // Hold: minimum of the wanted gain over the look-ahead window
+            if (holdCount > 0 && holdTimes[holdStart] <= time - holdSize) {
+                holdStart = (holdStart + 1) % holdSize;
+                --holdCount;
+            }
+            while (holdCount > 0 && holdValues[(holdStart + holdCount - 1) % holdSize] >= wanted)
+                --holdCount;
+            holdValues[(holdStart + holdCount) % holdSize] = wanted;
+            holdTimes[(holdStart + holdCount) % holdSize] = time;
+            ++holdCount;
+            const float held = holdValues[holdStart];
+
+            // Instant attack, exponential release
+            envelope = held < envelope ? held : held + releaseCoefficient * (envelope - held);
+
+            // Average: the gain ramps down over the look-ahead time instead of jumping
+            averageSum += envelope - averageWindow[averagePosition];
+            averageWindow[averagePosition] = envelope;
+            averagePosition = (averagePosition + 1) % lookahead;
+
+            gains[i] = static_cast<float>(averageSum / lookahead);
+        }
+    }
+};
@@ -1,6 +1,6 @@
 /*
 * Custom Button for the mapping buttons. This is a juce::TextButton containing a reference
-* to its slider.
+* to its slider, and the ID of the parameter of the slider for MIDI learn.
 */
 #pragma once
 
@@ -8,8 +8,10 @@
 
 class MapButton : public juce::TextButton {
 public:
-    MapButton(juce::Slider* attachedSlider) : TextButton() {
+    MapButton(juce::Slider* attachedSlider, const juce::String& parameterID) : TextButton() {
         this->attachedSlider = attachedSlider;
+        this->parameterID = parameterID;
     }
     juce::Slider* attachedSlider;
+    juce::String parameterID;
 };
\ No newline at end of file
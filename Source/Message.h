@@ -8,9 +8,17 @@ Structure of the messages used by this application to update the state of the sl
 #define MINUS_SIGN 45
 #define X_AXIS 71
 #define Y_AXIS 66
+#define Z_AXIS 82
 
 struct Message {
-    char direction; // May be either B (for Y axis) or G (for X axis)
+    char direction; // May be either B (for Y axis), G (for X axis) or R (for Z axis, binary stream only)
     char verse; // + or -
     int value; // Intensity
+    int controller{ 0 }; // Index of the controller (serial port or OSC ID) the message comes from
+    double time{ 0.0 }; // When the sensor took the sample, in ms of juce::Time::getMillisecondCounterHiRes()
 };
+
+// 0, 1 and 2 for the X, Y and Z axes, -1 for anything else
+inline int axisIndex(char direction) {
+    return direction == X_AXIS ? 0 : direction == Y_AXIS ? 1 : direction == Z_AXIS ? 2 : -1;
+}
@@ -0,0 +1,77 @@
+/*
+* Meter bridge of the editor: one bar for each MeterPoint, showing the peak (thin line)
+* and the RMS (bar), plus the short-term loudness of the output. The editor timer
+* passes the readings with setReadings(), which only repaints if something moved.
+*/
+#pragma once
+
+#include <JuceHeader.h>
+#include "LevelMeter.h"
+
+class MeterDisplay : public juce::Component {
+public:
+    void setReadings(const LevelMeters::Readings& newReadings) {
+        bool changed = false;
+        for (size_t i = 0; i < readings.size(); ++i) {
+            changed = changed || std::abs(newReadings[i].peakDb - readings[i].peakDb) > 0.1f
+                              || std::abs(newReadings[i].rmsDb - readings[i].rmsDb) > 0.1f
+                              || std::abs(newReadings[i].loudness - readings[i].loudness) > 0.1f;
+        }
+        if (!changed)
+            return;
+
+        readings = newReadings;
+        repaint();
+    }
+
+    void paint(juce::Graphics& g) override {
+        const auto bounds = getLocalBounds();
+        const int labelHeight = 20;
+        const int barWidth = bounds.getWidth() / LevelMeters::numPoints;
+        const int top = labelHeight;
+        const int bottom = bounds.getHeight() - 2 * labelHeight;
+
+        g.setFont(11.0f);
+
+        for (int i = 0; i < LevelMeters::numPoints; ++i) {
+            const int x = i * barWidth + 2;
+            const auto& reading = readings[static_cast<size_t>(i)];
+
+            g.setColour(backgroundColor);
+            g.fillRect(x, top, barWidth - 4, bottom - top);
+
+            const int rmsY = levelToY(reading.rmsDb, top, bottom);
+            g.setColour(reading.peakDb > -1.0f ? clipColor : barColor);
+            g.fillRect(x, rmsY, barWidth - 4, bottom - rmsY);
+
+            const int peakY = levelToY(reading.peakDb, top, bottom);
+            g.setColour(peakColor);
+            g.fillRect(x, peakY, barWidth - 4, 2);
+
+            g.setColour(textColor);
+            g.drawText(names[static_cast<size_t>(i)], x - 2, bottom, barWidth, labelHeight, juce::Justification::centred);
+        }
+
+        const float loudness = readings.back().loudness;
+        g.drawText(loudness <= LevelMeter::minDb ? juce::String("-inf LUFS") : juce::String(loudness, 1) + " LUFS",
+                   0, bounds.getHeight() - labelHeight, bounds.getWidth(), labelHeight, juce::Justification::centred);
+    }
+
+private:
+    static constexpr float rangeDb = 60.0f;
+
+    LevelMeters::Readings readings{};
+    const std::array<const char*, LevelMeters::numPoints> names{ "IN", "EQ", "DST", "SPC", "DLY", "OUT" };
+
+    juce::Colour backgroundColor{ juce::Colour(45, 45, 45) };
+    juce::Colour barColor{ juce::Colour(60, 170, 90) };
+    juce::Colour clipColor{ juce::Colour(210, 60, 50) };
+    juce::Colour peakColor{ juce::Colour(230, 230, 230) };
+    juce::Colour textColor{ juce::Colour(230, 230, 230) };
+
+    // 0 dBFS at the top, -rangeDb at the bottom
+    static int levelToY(float db, int top, int bottom) {
+        const float proportion = juce::jlimit(0.0f, 1.0f, (db + rangeDb) / rangeDb);
+        return bottom - juce::roundToInt(proportion * (bottom - top));
+    }
+};
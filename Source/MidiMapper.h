@@ -0,0 +1,384 @@
+/*
+  This class maps MIDI controllers to the parameters of the plugin. A mapping goes from a
+  source (a CC, or the channel pressure or pitch bend of MPE) to any parameter, through a
+  curve and a smoothing time.
+
+  Mappings are made by learning: startLearn() arms a parameter, the audio thread captures
+  the first mappable event that comes in, and commitLearn() turns it into a mapping on the
+  message thread. CC 74 (MPE slide), channel pressure and pitch bend are learned on any
+  channel, so every note of an MPE controller drives the mapping whatever its member channel.
+
+  The audio thread splits the block at the events, see EQAudioProcessor::processBlock():
+  apply() stores the mapped values in the raw values of the AudioProcessorValueTreeState,
+  the atomics the chain reads, before the chunk starting at an event. The change starts at
+  that sample; the equalizer and the distortion ramp to it over the next kControlBlockSize
+  samples, like they do for any parameter change. While a mapping is smoothing, the chunks
+  are short and advance() moves the values between them.
+
+  setValueNotifyingHost() calls the host and the listeners synchronously, so it is not
+  called on the audio thread. apply() queues the values instead, and notifyHost() passes
+  them on from the message thread, so the host automation and the editor follow.
+
+  Mappings reach the audio thread like the snapshots of PresetMorph, through a SpinLock
+  that the audio thread only tries to take.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+enum class MidiSourceType
+{
+    controller,
+    channelPressure,
+    pitchBend
+};
+
+// Curves in the order of curveNames
+enum class MidiCurve
+{
+    linear,
+    exponential,
+    logarithmic,
+    sCurve
+};
+
+struct MidiMapping {
+    MidiSourceType type;
+    int channel;        // 1 to 16, 0 for any channel
+    int number;         // CC number, unused for pressure and pitch bend
+    juce::RangedAudioParameter* parameter;
+    std::atomic<float>* rawValue;   // what the chain reads, in the range of the parameter
+    MidiCurve curve;
+    float smoothingMs;
+};
+
+class MidiMapper {
+
+public:
+    static constexpr int maxMappings = 16;
+    static inline const juce::StringArray curveNames{ "Linear", "Exponential", "Logarithmic", "S-Curve" };
+
+    //===== Message thread =====
+
+    void startLearn(juce::RangedAudioParameter* parameter, std::atomic<float>* rawValue)
+    {
+        learnParameter = parameter;
+        learnRawValue = rawValue;
+        learnState = LearnState::armed;
+    }
+
+    void cancelLearn()
+    {
+        auto expected = LearnState::armed;
+        learnState.compare_exchange_strong(expected, LearnState::idle);
+    }
+
+    bool isLearning() const { return learnState.load() != LearnState::idle; }
+
+    // Turns the event captured by the audio thread into a mapping. A parameter has at
+    // most one mapping: learning it again replaces the old one. Returns true if a mapping was made.
+    bool commitLearn()
+    {
+        if (learnState.load() != LearnState::captured)
+            return false;
+
+        MidiMapping mapping{ learnedType.load(), learnedChannel.load(), learnedNumber.load(), learnParameter,
+                             learnRawValue, MidiCurve::linear, defaultSmoothingMs };
+        learnState = LearnState::idle;
+        return add(mapping);
+    }
+
+    // Adds a mapping, or replaces the one of the same parameter, e.g. when loading a state.
+    // Returns false if there are already maxMappings.
+    bool add(const MidiMapping& mapping)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        int index = 0;
+        while (index < numPending && pending[index].parameter != mapping.parameter)
+            index++;
+        if (index == maxMappings)
+            return false;
+        if (index == numPending)
+            numPending++;
+        pending[index] = mapping;
+        changed();
+        return true;
+    }
+
+    void clear()
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        numPending = 0;
+        changed();
+    }
+
+    // Passes the values written by the audio thread to the host, the last one of each parameter.
+    // A value the chain no longer reads is skipped, a newer one is queued behind it: notifying
+    // it would store it back into the raw value.
+    void notifyHost()
+    {
+        const auto scope = notificationFifo.read(notificationFifo.getNumReady());
+        const int numRead = scope.blockSize1 + scope.blockSize2;
+        for (int i = 0; i < numRead; i++) {
+            const auto& notification = notifications[(scope.startIndex1 + i) % notificationFifoSize];
+
+            bool superseded = false;
+            for (int j = i + 1; j < numRead && !superseded; j++)
+                superseded = notifications[(scope.startIndex1 + j) % notificationFifoSize].parameter == notification.parameter;
+
+            auto* parameter = notification.parameter;
+            if (superseded || parameter->getValue() == notification.value
+                || notification.rawValue->load() != parameter->convertFrom0to1(notification.value))
+                continue;
+
+            parameter->beginChangeGesture();
+            parameter->setValueNotifyingHost(notification.value);
+            parameter->endChangeGesture();
+        }
+    }
+
+    int getNumMappings() const
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        return numPending;
+    }
+
+    MidiMapping getMapping(int index) const
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        return pending[index];
+    }
+
+    void setCurve(int index, MidiCurve curve)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        if (index >= 0 && index < numPending) {
+            pending[index].curve = curve;
+            changed();
+        }
+    }
+
+    void setSmoothing(int index, float smoothingMs)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        if (index >= 0 && index < numPending) {
+            pending[index].smoothingMs = smoothingMs;
+            changed();
+        }
+    }
+
+    void remove(int index)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        if (index >= 0 && index < numPending) {
+            for (int i = index; i < numPending - 1; i++)
+                pending[i] = pending[i + 1];
+            numPending--;
+            changed();
+        }
+    }
+
+    // Goes up every time the mappings change, so the editor knows when to list them again
+    int getVersion() const { return version; }
+
+    //===== Audio thread =====
+
+    void prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        for (auto& state : states)
+            state.hasValue = false;
+    }
+
+    // Picks up the mappings changed since the last call.
+    // Returns true if there is at least one mapping.
+    bool update()
+    {
+        if (pendingChanged) {
+            const juce::SpinLock::ScopedTryLockType lock(pendingLock);
+            if (lock.isLocked()) {
+                // A mapping that is still there keeps its value, so it doesn't jump
+                std::array<State, maxMappings> newStates{};
+                for (int i = 0; i < numPending; i++)
+                    for (int j = 0; j < numActive; j++)
+                        if (active[j].parameter == pending[i].parameter && active[j].type == pending[i].type
+                            && active[j].number == pending[i].number)
+                            newStates[i] = states[j];
+
+                active = pending;
+                numActive = numPending;
+                states = newStates;
+                pendingChanged = false;
+            }
+        }
+        return numActive > 0;
+    }
+
+    // Sets the target of the mappings driven by the event, and captures it while learning
+    void handleEvent(const juce::MidiMessage& message)
+    {
+        MidiSourceType type;
+        int number = 0;
+        float normalised;
+        if (message.isController()) {
+            type = MidiSourceType::controller;
+            number = message.getControllerNumber();
+            normalised = message.getControllerValue() / 127.0f;
+        }
+        else if (message.isChannelPressure()) {
+            type = MidiSourceType::channelPressure;
+            normalised = message.getChannelPressureValue() / 127.0f;
+        }
+        else if (message.isPitchWheel()) {
+            type = MidiSourceType::pitchBend;
+            normalised = message.getPitchWheelValue() / 16383.0f;
+        }
+        else
+            return;
+
+        const int channel = message.getChannel();
+
+        if (learnState.load() == LearnState::armed) {
+            const bool anyChannel = type != MidiSourceType::controller || number == 74;
+            learnedType = type;
+            learnedChannel = anyChannel ? 0 : channel;
+            learnedNumber = number;
+            learnState = LearnState::captured;
+        }
+
+        for (int i = 0; i < numActive; i++) {
+            const auto& mapping = active[i];
+            if (mapping.type != type || (type == MidiSourceType::controller && mapping.number != number)
+                || (mapping.channel != 0 && mapping.channel != channel))
+                continue;
+
+            auto& state = states[i];
+            state.target = applyCurve(mapping.curve, normalised);
+            if (!state.hasValue || mapping.smoothingMs <= 0.0f)
+                state.value = state.target;
+            state.hasValue = true;
+        }
+    }
+
+    // True while a mapping is moving towards its target
+    bool isSmoothing() const
+    {
+        for (int i = 0; i < numActive; i++)
+            if (states[i].hasValue && states[i].value != states[i].target)
+                return true;
+        return false;
+    }
+
+    // Writes the mapped parameters whose value changed, and queues them for notifyHost().
+    // A value that doesn't fit in the queue is queued again by the next call.
+    void apply()
+    {
+        for (int i = 0; i < numActive; i++) {
+            const auto& mapping = active[i];
+            auto& state = states[i];
+            if (!state.hasValue)
+                continue;
+
+            if (state.value != state.written) {
+                mapping.rawValue->store(mapping.parameter->convertFrom0to1(state.value));
+                state.written = state.value;
+                state.queued = false;
+            }
+            if (!state.queued) {
+                const auto scope = notificationFifo.write(1);
+                if (scope.blockSize1 > 0) {
+                    notifications[scope.startIndex1] = { mapping.parameter, mapping.rawValue, state.value };
+                    state.queued = true;
+                }
+            }
+        }
+    }
+
+    // Moves the smoothed values by numSamples
+    void advance(int numSamples)
+    {
+        for (int i = 0; i < numActive; i++) {
+            auto& state = states[i];
+            if (!state.hasValue || state.value == state.target)
+                continue;
+
+            const float coefficient = static_cast<float>(std::exp(-numSamples / (0.001 * active[i].smoothingMs * sampleRate)));
+            state.value = state.target + coefficient * (state.value - state.target);
+            if (std::abs(state.value - state.target) < settledDistance)
+                state.value = state.target;
+        }
+    }
+
+private:
+    static constexpr float defaultSmoothingMs = 20.0f;
+    static constexpr float settledDistance = 1.0e-4f;
+    static constexpr int notificationFifoSize = 256;
+
+    enum class LearnState
+    {
+        idle,
+        armed,
+        captured
+    };
+
+    // Normalised values of a mapping: where it goes, where it is, and what the parameter was last set to
+    struct State {
+        bool hasValue{ false };
+        float target{ 0.0f };
+        float value{ 0.0f };
+        float written{ -1.0f };
+        bool queued{ true };
+    };
+
+    struct Notification {
+        juce::RangedAudioParameter* parameter;
+        std::atomic<float>* rawValue;
+        float value;
+    };
+
+    static float applyCurve(MidiCurve curve, float x)
+    {
+        const float k = 3.0f;
+        switch (curve)
+        {
+        case MidiCurve::exponential: return (std::exp(k * x) - 1.0f) / (std::exp(k) - 1.0f);
+        case MidiCurve::logarithmic: return std::log(1.0f + (std::exp(k) - 1.0f) * x) / k;
+        case MidiCurve::sCurve:      return x * x * (3.0f - 2.0f * x);
+        case MidiCurve::linear:      break;
+        }
+        return x;
+    }
+
+    void changed()
+    {
+        pendingChanged = true;
+        version++;
+    }
+
+    double sampleRate{ 44100.0 };
+
+    // Learning: the message thread arms, the audio thread captures, the message thread commits
+    std::atomic<LearnState> learnState{ LearnState::idle };
+    juce::RangedAudioParameter* learnParameter{ nullptr };
+    std::atomic<float>* learnRawValue{ nullptr };
+    std::atomic<MidiSourceType> learnedType{ MidiSourceType::controller };
+    std::atomic<int> learnedChannel{ 0 };
+    std::atomic<int> learnedNumber{ 0 };
+
+    // Written by the message thread under pendingLock
+    std::array<MidiMapping, maxMappings> pending{};
+    int numPending{ 0 };
+    std::atomic<bool> pendingChanged{ false };
+    std::atomic<int> version{ 0 };
+    mutable juce::SpinLock pendingLock;
+
+    // Mappings used by the audio thread, and their values
+    std::array<MidiMapping, maxMappings> active{};
+    int numActive{ 0 };
+    std::array<State, maxMappings> states{};
+
+    // Values written by the audio thread, waiting for notifyHost()
+    juce::AbstractFifo notificationFifo{ notificationFifoSize };
+    std::array<Notification, notificationFifoSize> notifications{};
+};
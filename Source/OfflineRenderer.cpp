@@ -0,0 +1,131 @@
+/*
+* Implementation of OfflineRenderer.h
+*/
+
+#include "OfflineRenderer.h"
+#include "PluginProcessor.h"
+
+class OfflineRenderer::RenderJob : public juce::ThreadPoolJob
+{
+public:
+    RenderJob(const OfflineRenderer& renderer, const juce::File& input, juce::Result& result)
+        : ThreadPoolJob("Render " + input.getFileName()), renderer(renderer), input(input), result(result)
+    {
+    }
+
+    JobStatus runJob() override
+    {
+        result = renderer.renderFile(input);
+        return jobHasFinished;
+    }
+
+private:
+    const OfflineRenderer& renderer;
+    juce::File input;
+    juce::Result& result;
+};
+
+OfflineRenderer::OfflineRenderer(RenderSettings newSettings)
+    : settings(std::move(newSettings))
+{
+}
+
+juce::Array<juce::Result> OfflineRenderer::render(const juce::Array<juce::File>& inputs)
+{
+    juce::Array<juce::Result> results;
+    for (int i = 0; i < inputs.size(); ++i)
+        results.add(juce::Result::fail("not rendered"));
+
+    // The pool threads pick the next file as soon as they are done with the previous one,
+    // so long and short files balance out across the threads.
+    juce::ThreadPool pool(juce::jmax(1, settings.numThreads));
+    for (int i = 0; i < inputs.size(); ++i)
+        pool.addJob(new RenderJob(*this, inputs[i], results.getReference(i)), true);
+
+    while (pool.getNumJobs() > 0)
+        juce::Thread::sleep(10);
+
+    return results;
+}
+
+juce::Result OfflineRenderer::renderFile(const juce::File& input) const
+{
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(input));
+    if (reader == nullptr)
+        return juce::Result::fail(input.getFullPathName() + ": unsupported or unreadable audio file");
+
+    const int numChannels = static_cast<int>(reader->numChannels);
+    const double sampleRate = reader->sampleRate;
+    const int blockSize = juce::jmax(1, settings.blockSize);
+
+    EQAudioProcessor processor;
+    processor.setSpectrumAnalysisEnabled(false);
+    processor.setNonRealtime(true);
+
+    juce::AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+    layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+    if (!processor.setBusesLayout(layout))
+        return juce::Result::fail(input.getFullPathName() + ": " + juce::String(numChannels) + " channels are not supported");
+
+    if (settings.automation != nullptr)
+        settings.automation->apply(processor, 0.0);
+
+    processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+    processor.prepareToPlay(sampleRate, blockSize);
+
+    const juce::File output = settings.outputDirectory.getChildFile(input.getFileNameWithoutExtension() + ".wav");
+    output.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> stream = output.createOutputStream();
+    if (stream == nullptr)
+        return juce::Result::fail(output.getFullPathName() + ": can't be written");
+
+    juce::WavAudioFormat wavFormat;
+    std::unique_ptr<juce::AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(), sampleRate,
+        static_cast<unsigned int>(numChannels), 24, {}, 0));
+    if (writer == nullptr)
+        return juce::Result::fail(output.getFullPathName() + ": can't create the WAV writer");
+    stream.release(); // now owned by the writer
+
+    // The first `latency` output samples are the delay of the spectral stage: they are
+    // dropped, and as many samples are rendered after the end of the file, plus the tail.
+    const juce::int64 latency = processor.getLatencySamples();
+    double tailSeconds = processor.getTailLengthSeconds();
+    if (!std::isfinite(tailSeconds) || tailSeconds > settings.maxTailSeconds)
+        tailSeconds = settings.maxTailSeconds;
+    const juce::int64 tail = static_cast<juce::int64>(std::ceil(juce::jmax(0.0, tailSeconds) * sampleRate));
+    const juce::int64 totalLength = reader->lengthInSamples + tail + latency;
+
+    juce::AudioBuffer<float> buffer(numChannels, blockSize);
+    juce::MidiBuffer midiMessages;
+
+    for (juce::int64 position = 0; position < totalLength; position += blockSize) {
+        const int numSamples = static_cast<int>(juce::jmin<juce::int64>(blockSize, totalLength - position));
+
+        // The reader fills with zeros after the end of the file.
+        buffer.clear();
+        reader->read(&buffer, 0, numSamples, position, true, true);
+
+        if (settings.automation != nullptr)
+            settings.automation->apply(processor, static_cast<double>(position) / sampleRate);
+
+        juce::AudioBuffer<float> block(buffer.getArrayOfWritePointers(), numChannels, numSamples);
+        processor.processBlock(block, midiMessages);
+
+        // The compensation is fixed at the start, an automation that switches the spectral
+        // stage or the limiter would shift the rest of the output
+        if (processor.getCurrentLatencySamples() != latency)
+            return juce::Result::fail(input.getFullPathName() + ": the automation changes the latency "
+                                      "(spectral_on or limiter_on), which the render can't compensate");
+
+        const int skip = static_cast<int>(juce::jlimit<juce::int64>(0, numSamples, latency - position));
+        if (!writer->writeFromAudioSampleBuffer(block, skip, numSamples - skip))
+            return juce::Result::fail(output.getFullPathName() + ": write error");
+    }
+
+    processor.releaseResources();
+    return juce::Result::ok();
+}
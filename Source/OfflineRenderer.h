@@ -0,0 +1,46 @@
+/*
+  Faster than real time rendering of the whole EQ/Distortion/Delay chain over
+  many audio files. Every file is a job with its own EQAudioProcessor, and the
+  jobs run in parallel on a juce::ThreadPool. The output files are 24-bit WAVs
+  with the same name as the inputs, compensated for the plugin latency and
+  extended by its tail.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "AutomationCurves.h"
+
+struct RenderSettings {
+    juce::File outputDirectory;
+    int numThreads = juce::SystemStats::getNumCpus();
+
+    // Parameters are automated at the start of every block, so this is also the
+    // automation resolution.
+    int blockSize = 32;
+
+    // Optional, shared read-only by all the jobs.
+    const AutomationCurves* automation = nullptr;
+
+    // Longest tail rendered after the end of a file. The delay at full feedback never
+    // dies out, its tail is infinite and gets cut here.
+    double maxTailSeconds = 30.0;
+};
+
+class OfflineRenderer
+{
+public:
+    explicit OfflineRenderer(RenderSettings settings);
+
+    // Renders every input file and waits for all of them.
+    // Returns one result per input, in the same order.
+    juce::Array<juce::Result> render(const juce::Array<juce::File>& inputs);
+
+    // Renders a single file on the calling thread.
+    juce::Result renderFile(const juce::File& input) const;
+
+private:
+    class RenderJob;
+
+    RenderSettings settings;
+};
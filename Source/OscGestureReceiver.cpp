@@ -0,0 +1,240 @@
+/*
+* Implementation of OscGestureReceiver.h
+*/
+
+#include "OscGestureReceiver.h"
+
+const juce::String kGestureAddress { "/gesture" };
+
+// The jitter buffer releases the frames with this period
+const int kReleasePeriodMs { 1 };
+
+// A jump of the sender timestamps larger than this resets the jitter buffer of the controller
+const int64_t kResyncMs { 5000 };
+
+OscGestureReceiver::OscGestureReceiver (std::function<void (const Message&)> onMessageCallback)
+    : onMessage (std::move (onMessageCallback))
+{
+    receiver.addListener (this);
+}
+
+OscGestureReceiver::~OscGestureReceiver ()
+{
+    disconnect ();
+    receiver.removeListener (this);
+}
+
+bool OscGestureReceiver::connect (int port)
+{
+    connected = receiver.connect (port);
+    if (connected)
+    {
+        // Frames left from a previous connection are released
+        updateTimer ();
+        juce::Logger::outputDebugString ("OSC gestures: listening on port " + juce::String (port));
+    }
+    else
+    {
+        // report error
+        juce::Logger::outputDebugString ("Unable to listen for OSC gestures on port " + juce::String (port));
+    }
+    return connected;
+}
+
+void OscGestureReceiver::disconnect (void)
+{
+    receiver.disconnect ();
+    connected = false;
+
+    // Not under timerLock: stopTimer() waits for a callback that may be waiting for it
+    stopTimer ();
+}
+
+void OscGestureReceiver::updateTimer (void)
+{
+    const juce::ScopedLock timerScope (timerLock);
+    bool shouldRun = false;
+    {
+        const juce::SpinLock::ScopedLockType lock (streamsLock);
+        shouldRun = releasing && connected;
+    }
+
+    if (shouldRun && !isTimerRunning ())
+        startTimer (kReleasePeriodMs);
+    else if (!shouldRun && isTimerRunning ())
+        stopTimer ();
+}
+
+void OscGestureReceiver::oscBundleReceived (const juce::OSCBundle& bundle)
+{
+    for (const auto& element : bundle)
+    {
+        if (element.isMessage ())
+            oscMessageReceived (element.getMessage ());
+        else if (element.isBundle ())
+            oscBundleReceived (element.getBundle ());
+    }
+}
+
+void OscGestureReceiver::oscMessageReceived (const juce::OSCMessage& message)
+{
+    if (message.getAddressPattern ().toString () != kGestureAddress || message.size () < 5)
+        return;
+    if (!message[0].isInt32 () || !message[1].isInt32 ()
+        || !message[2].isFloat32 () || !message[3].isFloat32 () || !message[4].isFloat32 ())
+        return;
+
+    const int controller = message[0].getInt32 () - 1;
+    if (controller < 0 || controller >= maxControllers)
+        return;
+
+    const float x = message[2].getFloat32 ();
+    const float y = message[3].getFloat32 ();
+    const float z = message[4].getFloat32 ();
+    if (!std::isfinite (x) || !std::isfinite (y) || !std::isfinite (z))
+        return;
+
+    if (addFrame (controller, message[1].getInt32 (), x, y, z))
+        updateTimer ();
+}
+
+bool OscGestureReceiver::addFrame (int controller, int32_t timestamp, float x, float y, float z)
+{
+    const double now = juce::Time::getMillisecondCounterHiRes ();
+    const juce::SpinLock::ScopedLockType lock (streamsLock);
+    auto& stream = streams[static_cast<size_t> (controller)];
+
+    // The difference with the previous timestamp is taken modulo 2^32,
+    // so the sender clock can wrap around
+    const int32_t step = static_cast<int32_t> (static_cast<uint32_t> (timestamp) - static_cast<uint32_t> (stream.lastTimestamp));
+
+    // A sender that restarted, or another sender on the same controller ID: start over
+    if (stream.hasTimestamp && std::abs (static_cast<int64_t> (step)) > kResyncMs)
+    {
+        stream.numFrames = 0;
+        stream.hasTimestamp = false;
+        stream.hasReleased = false;
+    }
+
+    if (stream.hasTimestamp)
+        stream.unwrappedTimestamp += step;
+    else
+        stream.unwrappedTimestamp = timestamp;
+    stream.lastTimestamp = timestamp;
+
+    const double offset = now - static_cast<double> (stream.unwrappedTimestamp);
+    if (!stream.hasTimestamp)
+    {
+        stream.currentMinOffset = stream.previousMinOffset = offset;
+        stream.windowStart = now;
+        stream.hasTimestamp = true;
+    }
+    else if (now > stream.windowStart + offsetWindowMs)
+    {
+        stream.previousMinOffset = stream.currentMinOffset;
+        stream.currentMinOffset = offset;
+        stream.windowStart = now;
+    }
+    else
+    {
+        stream.currentMinOffset = juce::jmin (stream.currentMinOffset, offset);
+    }
+
+    const int64_t frameTimestamp = stream.unwrappedTimestamp;
+    if (stream.hasReleased && frameTimestamp <= stream.lastReleased)
+    {
+        ++stream.lateFrames;
+        return false;
+    }
+    if (stream.numFrames == bufferSize)
+    {
+        ++stream.overflowFrames;
+        return false;
+    }
+
+    // Insertion in timestamp order, frames usually arrive in order so this is short.
+    // A duplicate of a frame still waiting replaces it.
+    int index = stream.numFrames;
+    while (index > 0 && stream.frames[static_cast<size_t> (index - 1)].timestamp > frameTimestamp)
+        --index;
+    if (index > 0 && stream.frames[static_cast<size_t> (index - 1)].timestamp == frameTimestamp)
+    {
+        stream.frames[static_cast<size_t> (index - 1)] = { frameTimestamp, x, y, z };
+        return false;
+    }
+    for (int i = stream.numFrames; i > index; --i)
+        stream.frames[static_cast<size_t> (i)] = stream.frames[static_cast<size_t> (i - 1)];
+    stream.frames[static_cast<size_t> (index)] = { frameTimestamp, x, y, z };
+    ++stream.numFrames;
+
+    const bool wasReleasing = releasing;
+    releasing = true;
+    return !wasReleasing;
+}
+
+void OscGestureReceiver::hiResTimerCallback ()
+{
+    const double now = juce::Time::getMillisecondCounterHiRes ();
+
+    for (int controller = 0; controller < maxControllers; ++controller)
+    {
+        // The frames due are copied out, so onMessage isn't called with the lock held
+        std::array<Frame, bufferSize> due;
+        int numDue = 0;
+        double minOffset = 0.0;
+        {
+            const juce::SpinLock::ScopedLockType lock (streamsLock);
+            auto& stream = streams[static_cast<size_t> (controller)];
+            minOffset = juce::jmin (stream.currentMinOffset, stream.previousMinOffset);
+
+            while (numDue < stream.numFrames
+                   && static_cast<double> (stream.frames[static_cast<size_t> (numDue)].timestamp) + minOffset + jitterDelayMs <= now)
+            {
+                due[static_cast<size_t> (numDue)] = stream.frames[static_cast<size_t> (numDue)];
+                ++numDue;
+            }
+            if (numDue == 0)
+                continue;
+
+            stream.hasReleased = true;
+            stream.lastReleased = due[static_cast<size_t> (numDue - 1)].timestamp;
+            stream.numFrames -= numDue;
+            for (int i = 0; i < stream.numFrames; ++i)
+                stream.frames[static_cast<size_t> (i)] = stream.frames[static_cast<size_t> (i + numDue)];
+        }
+
+        for (int i = 0; i < numDue; ++i)
+        {
+            // The sender time on the local clock, as if the frame had the fastest transit
+            const auto& frame = due[static_cast<size_t> (i)];
+            const double time = static_cast<double> (frame.timestamp) + minOffset;
+            emit (controller, X_AXIS, frame.x, time);
+            emit (controller, Y_AXIS, frame.y, time);
+            emit (controller, Z_AXIS, frame.z, time);
+        }
+    }
+
+    // Nothing left to release: the timer stops until the next frame
+    bool idle = true;
+    {
+        const juce::SpinLock::ScopedLockType lock (streamsLock);
+        for (const auto& stream : streams)
+            idle = idle && stream.numFrames == 0;
+        if (idle)
+            releasing = false;
+    }
+    if (idle)
+        updateTimer ();
+}
+
+void OscGestureReceiver::emit (int controller, char direction, float tilt, double time)
+{
+    Message message;
+    message.direction = direction;
+    message.verse = tilt < 0.0f ? MINUS_SIGN : PLUS_SIGN;
+    message.value = juce::roundToInt (100.0f * juce::jmin (std::abs (tilt), 1.0f));
+    message.controller = controller;
+    message.time = time;
+    if (onMessage != nullptr)
+        onMessage (message);
+}
@@ -0,0 +1,109 @@
+/*
+* Receives gesture frames over UDP, as OSC messages, from phones or sensor bridges.
+* It is an alternative to the serial controllers when an Arduino can't be cabled to the
+* computer running the plugin. Frames can be sent alone or in bundles:
+*
+*     /gesture  int32 controller (1 to maxControllers), int32 timestamp (ms, sender clock),
+*               float32 x, float32 y, float32 z (tilt, from -1 to 1)
+*
+* The network delays every frame by a different amount and can swap them, so the frames go
+* through a jitter buffer before becoming messages. A frame is released at its sender
+* timestamp plus the smallest transit offset seen in the last offsetWindowMs plus
+* jitterDelayMs: the frames keep the spacing they had on the sender, and come out in order.
+* Frames older than the last one released are dropped and counted as late.
+*
+* The 1 ms release timer only runs while frames are waiting: the first frame starts it and
+* it stops itself once every buffer is empty, so an idle or disconnected receiver costs nothing.
+*
+* Each released frame becomes one Message per axis, with the controller ID of the frame,
+* passed to onMessage like the messages of SerialDevice.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <functional>
+#include "Message.h"
+#include "SerialDevice.h"
+
+class OscGestureReceiver : private juce::OSCReceiver::Listener<juce::OSCReceiver::RealtimeCallback>,
+                           private juce::HighResolutionTimer
+{
+public:
+    static constexpr int maxControllers = SerialDevice::maxControllers;
+    static constexpr int jitterDelayMs = 20;
+
+    // onMessage is called on the timer thread of the jitter buffer.
+    explicit OscGestureReceiver (std::function<void (const Message&)> onMessage);
+    ~OscGestureReceiver () override;
+
+    // Listens on a UDP port, e.g. for a sender on the same machine through the loopback interface.
+    bool connect (int port);
+    void disconnect (void);
+    bool isConnected () const { return connected; }
+
+    // Whether the release timer is running, i.e. frames are waiting in the jitter buffer
+    bool isReleasing () const { return isTimerRunning (); }
+
+    // Frames that arrived after a newer one of the same controller had been released,
+    // or that didn't fit in the jitter buffer
+    uint32_t getLateFrames (int controller) const { return streams[static_cast<size_t> (controller)].lateFrames; }
+    uint32_t getOverflowFrames (int controller) const { return streams[static_cast<size_t> (controller)].overflowFrames; }
+
+private:
+    static constexpr int bufferSize = 64;
+    static constexpr double offsetWindowMs = 2000.0;
+
+    struct Frame
+    {
+        int64_t timestamp;
+        float x, y, z;
+    };
+
+    // Jitter buffer of one controller, frames sorted by timestamp
+    struct Stream
+    {
+        std::array<Frame, bufferSize> frames;
+        int numFrames { 0 };
+
+        // The 32-bit sender timestamps, unwrapped
+        bool hasTimestamp { false };
+        int32_t lastTimestamp { 0 };
+        int64_t unwrappedTimestamp { 0 };
+
+        // Smallest local time minus sender time in the current and the previous window,
+        // so the estimate follows the drift between the two clocks
+        double currentMinOffset { 0.0 }, previousMinOffset { 0.0 };
+        double windowStart { 0.0 };
+
+        bool hasReleased { false };
+        int64_t lastReleased { 0 };
+
+        std::atomic<uint32_t> lateFrames { 0 };
+        std::atomic<uint32_t> overflowFrames { 0 };
+    };
+
+    std::function<void (const Message&)> onMessage;
+
+    juce::OSCReceiver receiver;
+    std::atomic<bool> connected { false };
+
+    // Taken by the network thread to add a frame and by the timer to release them
+    juce::SpinLock streamsLock;
+    std::array<Stream, maxControllers> streams;
+
+    // Set with the first frame waiting and cleared once all the streams are empty, both under
+    // streamsLock, so a frame can't slip in between the check and the decision. updateTimer()
+    // makes the timer follow it; timerLock keeps its start and stop calls in order.
+    bool releasing { false };
+    juce::CriticalSection timerLock;
+    void updateTimer (void);
+
+    void oscMessageReceived (const juce::OSCMessage& message) override;
+    void oscBundleReceived (const juce::OSCBundle& bundle) override;
+    void hiResTimerCallback () override;
+
+    // Returns true if the frame is the first one waiting, and the timer must be started
+    bool addFrame (int controller, int32_t timestamp, float x, float y, float z);
+    void emit (int controller, char direction, float tilt, double time);
+};
@@ -11,34 +11,205 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "DeviceHub.h"
+
+// How a spectrum is packed into the OSC message.
+enum class SpectrumEncoding
+{
+    float32,        // one float32 argument per band on spectrumAddress (channel 0) or spectrumAddress/<channel>,
+                    // followed by the instance ID as an int32 argument
+    quantized8,     // a single blob of 8-bit dB values on /spectrum/blob
+    quantized16     // a single blob of 16-bit dB values on /spectrum/blob
+};
 
 //==============================================================================
 /**
+  Sends the spectra computed by the FFTProcessor to the visualizer, through the
+  socket shared by all the plugin instances (see DeviceHub.h).
+
+  The quantized encodings send one blob per spectrum, laid out as follows
+  (all fields little-endian):
+
+      offset  size  field
+      0       4     magic "FFXS"
+      4       1     version (1)
+      5       1     bits per band (8 or 16)
+      6       1     flags (bit 0: payload is a delta against the previous frame)
+      7       1     channel (0: left/mid/side/mono, 1: right in stereo analysis)
+      8       4     frame counter (uint32, wraps around)
+      12      2     number of bands (uint16)
+      14      2     instance ID (uint16), tells apart the plugin instances sharing the socket
+      16      4     sample rate (float32)
+      20      4     minDb (float32)
+      24      4     dbPerStep (float32)
+      28      ...   numBands values, 1 or 2 bytes each
+
+  To decode, for each band:
+      q  = delta ? (previousQ + value) mod 2^bits : value
+      dB = minDb + q * dbPerStep
+      magnitude = 10^(dB / 20)
+  Frame counters and delta state are kept separately for each channel.
+  A delta frame can only be decoded if the previous frame counter was received,
+  otherwise the client waits for the next key frame (flags bit 0 cleared), which
+  is sent every keyFrameInterval frames. Band i is centred at
+  i * sampleRate / (2 * (numBands - 1)) Hz. See Processing/FloatEQ/Osc.pde.
 */
 class OscManager
 {
 public:
-    OscManager() {
-        oscSender.connect(ip, port);
+    void setInstanceId(int newInstanceId)
+    {
+        instanceId = newInstanceId;
     }
-    void sendSpectrum(float* fftData, int fftSize)
+
+    void setSampleRate(double newSampleRate)
     {
-        juce::OSCAddressPattern address(spectrumAddress);
-        juce::OSCMessage message(address);
+        sampleRate = static_cast<float>(newSampleRate);
+    }
 
-        for (int i = 0; i < fftSize; ++i) {
-            message.addFloat32(fftData[i]);
+    // Selects how spectra are sent. Must not be called while sendSpectrum() is running.
+    void setEncoding(SpectrumEncoding newEncoding, bool useDeltaEncoding)
+    {
+        encoding = newEncoding;
+        deltaEncoding = useDeltaEncoding;
+        for (auto& state : channelStates) {
+            state.framesSinceKeyFrame = keyFrameInterval;
         }
+    }
+
+    void sendSpectrum(const float* fftData, int numBands, int channel)
+    {
+        jassert(channel >= 0 && channel < maxChannels);
+        auto& state = channelStates[channel];
+
+        if (encoding == SpectrumEncoding::float32) {
+            // Kept for older clients. The message grows with every argument, so this
+            // encoding allocates on the audio thread.
+            juce::OSCAddressPattern address(channel == 0 ? spectrumAddress : spectrumAddress + "/" + std::to_string(channel));
+            juce::OSCMessage message(address);
+
+            for (int i = 0; i < numBands; ++i) {
+                message.addFloat32(fftData[i]);
+            }
+            message.addInt32(instanceId);
 
-        oscSender.send(message);
+            deviceHub->sendOsc(message);
+        }
+        else {
+            sendQuantizedSpectrum(fftData, numBands, channel);
+        }
+        state.frameCounter += 1;
     }
 
 private:
+    void sendQuantizedSpectrum(const float* fftData, int numBands, int channel)
+    {
+        auto& state = channelStates[channel];
+
+        numBands = juce::jmin(numBands, maxBands);
+
+        const int bitsPerBand = encoding == SpectrumEncoding::quantized8 ? 8 : 16;
+        const int bytesPerBand = bitsPerBand / 8;
+        const uint32_t maxStep = (1u << bitsPerBand) - 1;
+        const float dbPerStep = (maxDb - minDb) / float(maxStep);
+
+        const bool isDelta = deltaEncoding && state.framesSinceKeyFrame < keyFrameInterval;
+        state.framesSinceKeyFrame = isDelta ? state.framesSinceKeyFrame + 1 : 1;
+
+        // The OSC message is written by hand in front of the blob: the address and the
+        // type tags never change, only the blob size does.
+        auto* packet = static_cast<uint8_t*>(blob.getData());
+        std::memcpy(packet, blobMessagePrefix, oscPrefixSize);
+
+        auto* bytes = packet + oscPrefixSize + 4;
+        bytes[0] = 'F'; bytes[1] = 'F'; bytes[2] = 'X'; bytes[3] = 'S';
+        bytes[4] = 1;
+        bytes[5] = static_cast<uint8_t>(bitsPerBand);
+        bytes[6] = isDelta ? 1 : 0;
+        bytes[7] = static_cast<uint8_t>(channel);
+        writeLittleEndian(bytes + 8, state.frameCounter);
+        writeLittleEndian(bytes + 12, static_cast<uint16_t>(numBands));
+        writeLittleEndian(bytes + 14, static_cast<uint16_t>(instanceId));
+        writeLittleEndian(bytes + 16, sampleRate);
+        writeLittleEndian(bytes + 20, minDb);
+        writeLittleEndian(bytes + 24, dbPerStep);
+
+        uint8_t* payload = bytes + headerSize;
+        for (int i = 0; i < numBands; ++i) {
+            // Avoid log10(0) on silent bins, they end up at minDb anyway.
+            const float db = 20.0f * std::log10(juce::jmax(fftData[i], 1.0e-9f));
+            const float step = (juce::jlimit(minDb, maxDb, db) - minDb) / dbPerStep;
+            const uint32_t q = static_cast<uint32_t>(step + 0.5f);
+
+            // Deltas wrap around modulo 2^bits, the client undoes it with the same modulo.
+            const uint32_t value = isDelta ? ((q - state.previousSteps[i]) & maxStep) : q;
+            state.previousSteps[i] = static_cast<uint16_t>(q);
+
+            if (bytesPerBand == 1) {
+                payload[i] = static_cast<uint8_t>(value);
+            }
+            else {
+                writeLittleEndian(payload + 2 * i, static_cast<uint16_t>(value));
+            }
+        }
+
+        // OSC blobs are preceded by their size (big-endian) and padded to a multiple of 4 bytes
+        const int blobSize = headerSize + numBands * bytesPerBand;
+        const int paddedSize = (blobSize + 3) & ~3;
+        const uint32_t bigEndianSize = juce::ByteOrder::swapIfLittleEndian(static_cast<uint32_t>(blobSize));
+        std::memcpy(packet + oscPrefixSize, &bigEndianSize, 4);
+        std::fill(bytes + blobSize, bytes + paddedSize, uint8_t(0));
+
+        deviceHub->sendOscPacket(packet, oscPrefixSize + 4 + paddedSize);
+    }
+
+    template <typename T>
+    static void writeLittleEndian(uint8_t* dest, T value)
+    {
+        uint8_t raw[sizeof(T)];
+        std::memcpy(raw, &value, sizeof(T));
+       #if JUCE_BIG_ENDIAN
+        std::reverse(raw, raw + sizeof(T));
+       #endif
+        std::memcpy(dest, raw, sizeof(T));
+    }
+
+    static constexpr int headerSize = 28;
+    static constexpr int maxChannels = 2;
+    static constexpr int maxBands = 4097;   // enough for an FFT of order 13
+
+    // Range of the quantized values, in dB of the raw FFT magnitude.
+    // The visualizer shows 20*log10(magnitude * 0.01) from -120 to 0 dB.
+    static constexpr float minDb = -80.0f;
+    static constexpr float maxDb = 40.0f;
+
+    // A key frame is sent every keyFrameInterval frames, so a client that lost
+    // a packet resynchronises quickly when delta encoding is enabled.
+    static constexpr int keyFrameInterval = 16;
 
     std::string spectrumAddress = "/spectrum";
+    // Address "/spectrum/blob" and type tags ",b", both null-terminated and padded to 4 bytes
+    static constexpr int oscPrefixSize = 20;
+    static constexpr char blobMessagePrefix[oscPrefixSize + 1] = "/spectrum/blob\0\0,b\0";
+
+    SpectrumEncoding encoding = SpectrumEncoding::float32;
+    bool deltaEncoding = false;
+
+    float sampleRate = 44100.0f;
+
+    // Frame counter, key frame countdown and last quantized value of each band, per channel.
+    struct ChannelState {
+        uint32_t frameCounter = 0;
+        int framesSinceKeyFrame = keyFrameInterval;
+        std::array<uint16_t, maxBands> previousSteps{};
+    };
+    std::array<ChannelState, maxChannels> channelStates;
+
+    // The whole OSC packet of a quantized spectrum: prefix, blob size, blob and padding.
+    // Allocated once, so sending a spectrum doesn't allocate.
+    juce::MemoryBlock blob{ size_t(oscPrefixSize + 4 + headerSize + maxBands * 2 + 3), true };
 
-    std::string ip = "127.0.0.1";
-    int port = 7771;
+    int instanceId = 0;
 
-    juce::OSCSender oscSender;
+    juce::SharedResourcePointer<DeviceHub> deviceHub;
 };
@@ -18,19 +18,29 @@ EQAudioProcessorEditor::EQAudioProcessorEditor (EQAudioProcessor& p)
 
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (640, 460);
+    setSize (795, 740);
     
     eqPanel.setBounds(5, 5, 255, 245);
     distortionPanel.setBounds(265, 5, 250, 450);
     delayPanel.setBounds(5, 255, 255, 200);
     volumePanel.setBounds(520, 5, 115, 290);
     mapPanel.setBounds(520, 300, 115, 155);
+    meterPanel.setBounds(640, 5, 150, 450);
+    analyserPanel.setBounds(5, 460, 785, 155);
+    morphPanel.setBounds(5, 620, 785, 35);
+    midiPanel.setBounds(5, 660, 785, 35);
+    predictionPanel.setBounds(5, 700, 785, 35);
 
     initialize_equalizer_parameters();
     initialize_distortion_parameters();
     initialize_delay_parameters();
     initialize_out_parameters();
     initialize_mapping_buttons();
+    initialize_meters();
+    initialize_analyser();
+    initialize_morph();
+    initialize_midi();
+    initialize_prediction();
 }
 
 EQAudioProcessorEditor::~EQAudioProcessorEditor()
@@ -51,6 +61,11 @@ void EQAudioProcessorEditor::paint (juce::Graphics& g)
     g.setColour(panelBackgroundColorDark);
     g.fillRect(volumePanel);
     g.fillRect(mapPanel);
+    g.fillRect(meterPanel);
+    g.fillRect(analyserPanel);
+    g.fillRect(morphPanel);
+    g.fillRect(midiPanel);
+    g.fillRect(predictionPanel);
 
     g.setFont (14.0f);
 }
@@ -65,7 +80,11 @@ void EQAudioProcessorEditor::resized()
     resize_delay_parameters();
     resize_out_parameters();
     resize_mapping_buttons();
-
+    resize_meters();
+    resize_analyser();
+    resize_morph();
+    resize_midi();
+    resize_prediction();
 }
 
 void EQAudioProcessorEditor::initialize_equalizer_parameters(){
@@ -395,8 +414,8 @@ void EQAudioProcessorEditor::resize_out_parameters() {
 }
 
 void EQAudioProcessorEditor::initialize_mapping_buttons() {
-    param1Button.setButtonText("MAP X");
-    param2Button.setButtonText("MAP Y");
+    param1Button.setButtonText("MAP 1");
+    param2Button.setButtonText("MAP 2");
 
     mapPanelLabel.setText("Mapping", juce::dontSendNotification);
     mapPanelLabel.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
@@ -410,6 +429,19 @@ void EQAudioProcessorEditor::initialize_mapping_buttons() {
     param1Button.addListener(this);
     param2Button.addListener(this);
 
+    //"C1 X", "C1 Y", "C1 Z", "C2 X", ...: the source of each mapping
+    const char axes[] = { 'X', 'Y', 'Z' };
+    for (auto* box : { &source1Box, &source2Box }) {
+        for (int controller = 0; controller < DeviceHub::maxControllers; controller++)
+            for (int axis = 0; axis < 3; axis++)
+                box->addItem("C" + juce::String(controller + 1) + " " + juce::String::charToString(axes[axis]), 1 + 3 * controller + axis);
+        box->setColour(juce::ComboBox::ColourIds::backgroundColourId, panelBackgroundColorDark);
+        box->setColour(juce::ComboBox::ColourIds::textColourId, textColor);
+        addAndMakeVisible(*box);
+    }
+    source1Box.setSelectedId(1, juce::dontSendNotification);
+    source2Box.setSelectedId(2, juce::dontSendNotification);
+
     addAndMakeVisible(param1Button);
     addAndMakeVisible(param2Button);
     addAndMakeVisible(mapPanelLabel);
@@ -417,8 +449,292 @@ void EQAudioProcessorEditor::initialize_mapping_buttons() {
 
 void EQAudioProcessorEditor::resize_mapping_buttons() {
     mapPanelLabel.setBounds(520, 310, 115, 30);
-    param1Button.setBounds(520 + 20, 360, 80, 30);
-    param2Button.setBounds(520 + 20, 400, 80, 30);
+    param1Button.setBounds(520 + 5, 360, 50, 30);
+    source1Box.setBounds(520 + 58, 360, 52, 30);
+    param2Button.setBounds(520 + 5, 400, 50, 30);
+    source2Box.setBounds(520 + 58, 400, 52, 30);
+}
+
+void EQAudioProcessorEditor::initialize_meters() {
+    meterPanelLabel.setText("Meters", juce::dontSendNotification);
+    meterPanelLabel.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
+    meterPanelLabel.setJustificationType(12);
+
+    addAndMakeVisible(meterPanelLabel);
+    addAndMakeVisible(meterDisplay);
+}
+
+void EQAudioProcessorEditor::resize_meters() {
+    meterPanelLabel.setBounds(640, 15, 150, 30);
+    meterDisplay.setBounds(645, 50, 140, 400);
+}
+
+void EQAudioProcessorEditor::initialize_analyser() {
+    addAndMakeVisible(spectrumDisplay);
+
+    initialize_analysis_box(analysisAggregationLabel, analysisAggregationBox, "Spectra", "analysis_aggregation");
+    initialize_analysis_box(analysisModeLabel, analysisModeBox, "Input", "analysis_mode");
+    initialize_analysis_box(analysisSizeLabel, analysisSizeBox, "FFT Size", "analysis_size");
+    initialize_analysis_box(analysisOverlapLabel, analysisOverlapBox, "Overlap", "analysis_overlap");
+}
+
+void EQAudioProcessorEditor::initialize_analysis_box(juce::Label& label, juce::ComboBox& box, const juce::String& text, const juce::String& parameterID) {
+    label.setText(text, juce::dontSendNotification);
+    label.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
+    addAndMakeVisible(label);
+
+    // The items must be there before the attachment selects the current one
+    if (auto* choice = dynamic_cast<juce::AudioParameterChoice*>(audioProcessor.analysis_apvts.getParameter(parameterID)))
+        box.addItemList(choice->choices, 1);
+    box.setColour(juce::ComboBox::ColourIds::backgroundColourId, panelBackgroundColorLight);
+    box.setColour(juce::ComboBox::ColourIds::textColourId, textColor);
+    analysisAttachments.push_back(std::make_unique<juce::AudioProcessorValueTreeState::ComboBoxAttachment>(
+        audioProcessor.analysis_apvts, parameterID, box));
+    addAndMakeVisible(box);
+}
+
+void EQAudioProcessorEditor::resize_analyser() {
+    spectrumDisplay.setBounds(10, 465, 660, 145);
+
+    analysisAggregationLabel.setBounds(675, 465, 110, 14);
+    analysisAggregationBox.setBounds(675, 479, 110, 20);
+    analysisModeLabel.setBounds(675, 500, 110, 14);
+    analysisModeBox.setBounds(675, 514, 110, 20);
+    analysisSizeLabel.setBounds(675, 535, 110, 14);
+    analysisSizeBox.setBounds(675, 549, 110, 20);
+    analysisOverlapLabel.setBounds(675, 570, 110, 14);
+    analysisOverlapBox.setBounds(675, 584, 110, 20);
+}
+
+void EQAudioProcessorEditor::initialize_morph() {
+    morphPanelLabel.setText("Morph", juce::dontSendNotification);
+    morphPanelLabel.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
+    addAndMakeVisible(morphPanelLabel);
+
+    morphOnButton.setButtonText("ON");
+    morphOnButton.setColour(juce::ToggleButton::ColourIds::textColourId, textColor);
+    morphOnAttach = std::make_unique<juce::AudioProcessorValueTreeState::ButtonAttachment>(
+        audioProcessor.modulation_apvts, "morph_on", morphOnButton);
+    addAndMakeVisible(morphOnButton);
+
+    // Each button stores the current parameters in its slot
+    const char* slotNames[PresetMorph::maxSnapshots]{ "A", "B", "C", "D" };
+    for (int slot = 0; slot < PresetMorph::maxSnapshots; slot++) {
+        morphStoreButtons[slot].setButtonText(slotNames[slot]);
+        morphStoreButtons[slot].onClick = [this, slot]() {
+            audioProcessor.storeMorphSnapshot(slot);
+            update_morph_buttons();
+        };
+        addAndMakeVisible(morphStoreButtons[slot]);
+    }
+
+    morphClearButton.setButtonText("CLEAR");
+    morphClearButton.onClick = [this]() {
+        audioProcessor.clearMorphSnapshots();
+        update_morph_buttons();
+    };
+    addAndMakeVisible(morphClearButton);
+
+    morphPositionSlider.setSliderStyle(juce::Slider::SliderStyle::LinearHorizontal);
+    morphPositionSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 50, 20);
+    morphPositionSlider.setColour(juce::Slider::ColourIds::textBoxTextColourId, textColor);
+    morphPositionSlider.setColour(juce::Slider::ColourIds::trackColourId, knobBackgroundColor);
+    morphPositionSlider.setColour(juce::Slider::ColourIds::thumbColourId, knobThumbColor);
+    morphPositionAttach = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
+        audioProcessor.modulation_apvts, "morph_position", morphPositionSlider);
+    addAndMakeVisible(morphPositionSlider);
+
+    addAndMakeVisible(morphMap);
+    initialize_mapping_button(morphMap);
+
+    update_morph_buttons();
+}
+
+void EQAudioProcessorEditor::resize_morph() {
+    morphPanelLabel.setBounds(10, 622, 60, 30);
+    morphOnButton.setBounds(70, 625, 50, 25);
+    for (int slot = 0; slot < PresetMorph::maxSnapshots; slot++)
+        morphStoreButtons[slot].setBounds(125 + slot * 45, 625, 40, 25);
+    morphClearButton.setBounds(310, 625, 55, 25);
+    morphMap.setBounds(375, 627, 30, 20);
+    morphPositionSlider.setBounds(410, 625, 370, 25);
+}
+
+// Stored slots are highlighted
+void EQAudioProcessorEditor::update_morph_buttons() {
+    for (int slot = 0; slot < PresetMorph::maxSnapshots; slot++)
+        morphStoreButtons[slot].setColour(juce::TextButton::ColourIds::buttonColourId,
+            audioProcessor.isMorphSnapshotStored(slot) ? map1ColorLight : mapNullColor);
+}
+
+void EQAudioProcessorEditor::initialize_midi() {
+    midiPanelLabel.setText("MIDI", juce::dontSendNotification);
+    midiPanelLabel.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
+    addAndMakeVisible(midiPanelLabel);
+
+    // LEARN, then the mapping button of a slider, then move a controller
+    midiLearnButton.setButtonText("LEARN");
+    midiLearnButton.setColour(juce::TextButton::ColourIds::buttonOnColourId, map1ColorLight);
+    midiLearnButton.onClick = [this]() {
+        auto& mapper = audioProcessor.getMidiMapper();
+        if (midiLearnArmed || mapper.isLearning()) {
+            midiLearnArmed = false;
+            mapper.cancelLearn();
+        }
+        else {
+            // The next mapping button clicked is for MIDI, not for the accelerometer
+            midiLearnArmed = true;
+            mapParameter1 = mapParameter2 = false;
+            param1Button.setToggleState(false, juce::NotificationType::dontSendNotification);
+            param2Button.setToggleState(false, juce::NotificationType::dontSendNotification);
+        }
+        midiLearnButton.setToggleState(midiLearnArmed || mapper.isLearning(), juce::NotificationType::dontSendNotification);
+    };
+    addAndMakeVisible(midiLearnButton);
+
+    for (auto* box : { &midiMappingBox, &midiCurveBox }) {
+        box->setColour(juce::ComboBox::ColourIds::backgroundColourId, panelBackgroundColorLight);
+        box->setColour(juce::ComboBox::ColourIds::textColourId, textColor);
+        addAndMakeVisible(*box);
+    }
+    midiMappingBox.setTextWhenNothingSelected("No MIDI mapping");
+
+    // Without a MIDI input the host sends no controller to learn from
+    if (!audioProcessor.acceptsMidi()) {
+        midiLearnButton.setEnabled(false);
+        midiMappingBox.setTextWhenNothingSelected("MIDI input disabled in this build");
+    }
+    midiMappingBox.onChange = [this]() { update_midi_mapping_controls(); };
+
+    midiCurveBox.addItemList(MidiMapper::curveNames, 1);
+    midiCurveBox.onChange = [this]() {
+        audioProcessor.getMidiMapper().setCurve(midiMappingBox.getSelectedItemIndex(),
+            static_cast<MidiCurve>(midiCurveBox.getSelectedItemIndex()));
+    };
+
+    midiSmoothingSlider.setSliderStyle(juce::Slider::SliderStyle::LinearHorizontal);
+    midiSmoothingSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 60, 20);
+    midiSmoothingSlider.setColour(juce::Slider::ColourIds::textBoxTextColourId, textColor);
+    midiSmoothingSlider.setColour(juce::Slider::ColourIds::trackColourId, knobBackgroundColor);
+    midiSmoothingSlider.setColour(juce::Slider::ColourIds::thumbColourId, knobThumbColor);
+    midiSmoothingSlider.setRange(0.0, 500.0, 1.0);
+    midiSmoothingSlider.setTextValueSuffix(" ms");
+    midiSmoothingSlider.onValueChange = [this]() {
+        audioProcessor.getMidiMapper().setSmoothing(midiMappingBox.getSelectedItemIndex(),
+            float(midiSmoothingSlider.getValue()));
+    };
+    addAndMakeVisible(midiSmoothingSlider);
+
+    midiRemoveButton.setButtonText("DELETE");
+    midiRemoveButton.onClick = [this]() {
+        audioProcessor.getMidiMapper().remove(midiMappingBox.getSelectedItemIndex());
+        update_midi_mappings();
+    };
+    addAndMakeVisible(midiRemoveButton);
+
+    update_midi_mappings();
+}
+
+void EQAudioProcessorEditor::resize_midi() {
+    midiPanelLabel.setBounds(10, 662, 60, 30);
+    midiLearnButton.setBounds(70, 665, 55, 25);
+    midiMappingBox.setBounds(130, 665, 260, 25);
+    midiCurveBox.setBounds(395, 665, 110, 25);
+    midiSmoothingSlider.setBounds(510, 665, 200, 25);
+    midiRemoveButton.setBounds(715, 665, 65, 25);
+}
+
+// Lists the mappings again, keeping the selection. A new mapping gets selected.
+void EQAudioProcessorEditor::update_midi_mappings() {
+    auto& mapper = audioProcessor.getMidiMapper();
+    midiMappingsVersion = mapper.getVersion();
+
+    const int previousCount = midiMappingBox.getNumItems();
+    int selected = midiMappingBox.getSelectedItemIndex();
+    midiMappingBox.clear(juce::dontSendNotification);
+
+    const int count = mapper.getNumMappings();
+    for (int i = 0; i < count; i++) {
+        const auto mapping = mapper.getMapping(i);
+        juce::String source = mapping.type == MidiSourceType::controller ? "CC " + juce::String(mapping.number)
+                            : mapping.type == MidiSourceType::channelPressure ? "Pressure" : "Pitch Bend";
+        source += mapping.channel == 0 ? " (any)" : " (ch " + juce::String(mapping.channel) + ")";
+        midiMappingBox.addItem(source + " > " + mapping.parameter->getName(30), i + 1);
+    }
+
+    if (count > previousCount)
+        selected = count - 1;
+    if (count > 0)
+        midiMappingBox.setSelectedItemIndex(juce::jlimit(0, count - 1, selected), juce::dontSendNotification);
+    update_midi_mapping_controls();
+}
+
+// Curve and smoothing of the selected mapping
+void EQAudioProcessorEditor::update_midi_mapping_controls() {
+    const int index = midiMappingBox.getSelectedItemIndex();
+    const bool hasMapping = index >= 0;
+    midiCurveBox.setEnabled(hasMapping);
+    midiSmoothingSlider.setEnabled(hasMapping);
+    midiRemoveButton.setEnabled(hasMapping);
+    if (!hasMapping)
+        return;
+
+    const auto mapping = audioProcessor.getMidiMapper().getMapping(index);
+    midiCurveBox.setSelectedItemIndex(static_cast<int>(mapping.curve), juce::dontSendNotification);
+    midiSmoothingSlider.setValue(mapping.smoothingMs, juce::dontSendNotification);
+}
+
+void EQAudioProcessorEditor::initialize_prediction() {
+    predictionPanelLabel.setText("Predict", juce::dontSendNotification);
+    predictionPanelLabel.setColour(juce::Label::ColourIds::textColourId, panelTitleColor);
+    addAndMakeVisible(predictionPanelLabel);
+
+    // The settings are shared by all the instances, the controls start from the current ones
+    predictionModeBox.addItemList(GesturePredictor::predictionModes, 1);
+    predictionModeBox.setColour(juce::ComboBox::ColourIds::backgroundColourId, panelBackgroundColorLight);
+    predictionModeBox.setColour(juce::ComboBox::ColourIds::textColourId, textColor);
+    predictionModeBox.setSelectedItemIndex(static_cast<int>(audioProcessor.getGesturePredictionMode()), juce::dontSendNotification);
+    addAndMakeVisible(predictionModeBox);
+
+    // How far ahead, as a fraction of the measured lag
+    predictionAggressivenessSlider.setSliderStyle(juce::Slider::SliderStyle::LinearHorizontal);
+    predictionAggressivenessSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 60, 20);
+    predictionAggressivenessSlider.setColour(juce::Slider::ColourIds::textBoxTextColourId, textColor);
+    predictionAggressivenessSlider.setColour(juce::Slider::ColourIds::trackColourId, knobBackgroundColor);
+    predictionAggressivenessSlider.setColour(juce::Slider::ColourIds::thumbColourId, knobThumbColor);
+    predictionAggressivenessSlider.setRange(0.0, 150.0, 1.0);
+    predictionAggressivenessSlider.setTextValueSuffix(" %");
+    predictionAggressivenessSlider.setValue(100.0 * audioProcessor.getGesturePredictionAggressiveness(), juce::dontSendNotification);
+    addAndMakeVisible(predictionAggressivenessSlider);
+
+    auto apply = [this]() {
+        audioProcessor.setGesturePrediction(static_cast<PredictionMode>(predictionModeBox.getSelectedItemIndex()),
+            float(predictionAggressivenessSlider.getValue() / 100.0));
+    };
+    predictionModeBox.onChange = apply;
+    predictionAggressivenessSlider.onValueChange = apply;
+
+    predictionStatsLabel.setColour(juce::Label::ColourIds::textColourId, textColor);
+    addAndMakeVisible(predictionStatsLabel);
+}
+
+void EQAudioProcessorEditor::resize_prediction() {
+    predictionPanelLabel.setBounds(10, 702, 60, 30);
+    predictionModeBox.setBounds(70, 705, 110, 25);
+    predictionAggressivenessSlider.setBounds(185, 705, 250, 25);
+    predictionStatsLabel.setBounds(440, 705, 340, 25);
+}
+
+// RMS error of the predictions at the measured lag, next to the error without prediction
+void EQAudioProcessorEditor::update_prediction_stats() {
+    const int controller = juce::jmax(0, source1Box.getSelectedId() - 1) / 3;
+    const auto& errors = audioProcessor.getGesturePredictionErrors(controller);
+
+    juce::String text = "C" + juce::String(controller + 1) + "  lag " + juce::String(juce::roundToInt(audioProcessor.getGestureLatency())) + " ms";
+    if (errors.count > 0)
+        text += "  error " + juce::String(std::sqrt(errors.meanSquare.load()), 1)
+              + " (" + juce::String(std::sqrt(errors.baselineMeanSquare.load()), 1) + " unpredicted)";
+    predictionStatsLabel.setText(text, juce::dontSendNotification);
 }
 
 void EQAudioProcessorEditor::filterButtonClicked(int index)
@@ -435,6 +751,10 @@ void EQAudioProcessorEditor::distortionButtonClicked(int index)
 
 void EQAudioProcessorEditor::buttonClicked(juce::Button* button) {
     
+    if (button == &param1Button || button == &param2Button) {
+        midiLearnArmed = false;
+        midiLearnButton.setToggleState(audioProcessor.getMidiMapper().isLearning(), juce::NotificationType::dontSendNotification);
+    }
     if (button == &param1Button) {
         button->setToggleState(true, juce::NotificationType::dontSendNotification);
         param2Button.setToggleState(false, juce::NotificationType::dontSendNotification);
@@ -462,7 +782,11 @@ void EQAudioProcessorEditor::initialize_mapping_button(MapButton& b) {
 //- handle multiple mappings
 //- handle the mapping changes
 void EQAudioProcessorEditor::mapButtonClicked(MapButton* b) {
-    if (mapParameter1) {
+    if (midiLearnArmed) {
+        audioProcessor.startMidiLearn(b->parameterID);
+        midiLearnArmed = false;
+    }
+    else if (mapParameter1) {
         if (mapButton1 != nullptr && mapButton1 != b) {
             mapButton1->setColour(juce::TextButton::ColourIds::buttonColourId, mapNullColor);
             if (param1 != nullptr) {
@@ -528,63 +852,70 @@ float logScale(float value) {
 }
 
 void EQAudioProcessorEditor::timerCallback() {
-    int messages_to_pop = 50;
-    float mean_value = 0;
-    int i = 0;
-    if (audioProcessor.serialDevice.isConnected) {
-        Message m;
-        for (i = 0; i < messages_to_pop; i++) {
-            if (audioProcessor.serialDevice.messages.empty())
-                break;
-            m = audioProcessor.serialDevice.messages.top();
-            audioProcessor.serialDevice.messages.pop();
-            DBG("AXIS:");
-            DBG(m.direction);
-            DBG("VERSE:");
-            DBG(m.verse);
-            DBG("VALUE");
-            DBG(m.value);
-            if (m.verse == MINUS_SIGN)
-                mean_value -= (float)m.value;
-            else {
-                mean_value += (float)m.value;
+    // MIDI learn is completed by the timer of the processor
+    auto& mapper = audioProcessor.getMidiMapper();
+    if (mapper.getVersion() != midiMappingsVersion)
+        update_midi_mappings();
+    midiLearnButton.setToggleState(midiLearnArmed || mapper.isLearning(), juce::NotificationType::dontSendNotification);
+
+    LevelMeters::Readings readings;
+    if (audioProcessor.getMeterReadings(readings))
+        meterDisplay.setReadings(readings);
+
+    // Only the newest spectrum is drawn, older ones are just taken out of the FIFO
+    bool newSpectrum = false;
+    while (audioProcessor.popSpectrumFrame(spectrumFrame))
+        newSpectrum = true;
+    if (newSpectrum)
+        spectrumDisplay.setFrame(spectrumFrame);
+
+    //Mean of the values received since the last call, and of the times they were sampled, for every controller and axis
+    const int messages_to_pop = 128;
+    std::array<std::array<float, 3>, DeviceHub::maxControllers> sums{};
+    std::array<std::array<double, 3>, DeviceHub::maxControllers> times{};
+    std::array<std::array<int, 3>, DeviceHub::maxControllers> counts{};
+    if (audioProcessor.isGestureInputConnected()) {
+        //Every queue is emptied, even when no slider follows its controller, so stale messages don't pile up
+        for (int controller = 0; controller < DeviceHub::maxControllers; controller++) {
+            Message m;
+            for (int i = 0; i < messages_to_pop && audioProcessor.popSensorMessage(controller, m); i++) {
+                const int axis = axisIndex(m.direction);
+                if (axis < 0)
+                    continue;
+                sums[controller][axis] += m.verse == MINUS_SIGN ? -(float)m.value : (float)m.value;
+                times[controller][axis] += m.time;
+                counts[controller][axis]++;
             }
         }
-        mean_value = mean_value / (float)i;
-
-        if (param1 != nullptr && m.direction == X_AXIS) {
-            float max = param1->getMaximum();
-            float min = param1->getMinimum();
-            float middle = (max + min) / 2;
-
-            if (param1 == &filterCutoff || param1 == &HPFKnob || param1 == &LPFKnob) {
-                if (m.verse == MINUS_SIGN) {
-                    param1->setValue(middle + (max - middle) * (-logScale(float(abs(mean_value)) / 100.0)));
-                }
-                else {
-                    param1->setValue(middle + (max - middle) * (float(mean_value) / 100.0));
-                }
-            }
-            else {
-                param1->setValue(middle + (max - middle) * (float(mean_value) / 100.0));
-            }
-        }
-        if (param2 != nullptr && m.direction == Y_AXIS) {
-            float max = param2->getMaximum();
-            float min = param2->getMinimum();
-            float middle = (max + min) / 2;
-            
-            if (param2 == &filterCutoff || param2 == &HPFKnob || param2 == &LPFKnob) {
-                if (m.verse == MINUS_SIGN) {
-                    param2->setValue(middle + (max - middle) * (-logScale(float(abs(mean_value)) / 100.0)));
-                }
-                else {
-                    param2->setValue(middle + (max - middle) * (float(mean_value) / 100.0));
-                }
-            }
-            else {
-                param2->setValue(middle + (max - middle) * (float(mean_value) / 100.0));
+
+        //The lag of a gesture: from the mean time of its samples to now, plus one audio block
+        //before the parameter is read. The predictor makes up for it.
+        const double now = juce::Time::getMillisecondCounterHiRes();
+        const double blockMs = audioProcessor.getSampleRate() > 0.0 ? 1000.0 * audioProcessor.getBlockSize() / audioProcessor.getSampleRate() : 0.0;
+
+        const std::pair<juce::Slider*, int> mappings[] = { { param1, source1Box.getSelectedId() - 1 },
+                                                           { param2, source2Box.getSelectedId() - 1 } };
+        for (const auto& mapping : mappings) {
+            const int controller = mapping.second / 3;
+            const int axis = mapping.second % 3;
+            if (mapping.first != nullptr && mapping.second >= 0 && counts[controller][axis] > 0) {
+                applyGesture(mapping.first, sums[controller][axis] / (float)counts[controller][axis]);
+                audioProcessor.reportGestureLatency(float(now - times[controller][axis] / counts[controller][axis] + blockMs));
             }
         }
     }
+    update_prediction_stats();
+}
+
+void EQAudioProcessorEditor::applyGesture(juce::Slider* param, float mean_value) {
+    float max = param->getMaximum();
+    float min = param->getMinimum();
+    float middle = (max + min) / 2;
+
+    if ((param == &filterCutoff || param == &HPFKnob || param == &LPFKnob) && mean_value < 0) {
+        param->setValue(middle + (max - middle) * (-logScale(float(abs(mean_value)) / 100.0)));
+    }
+    else {
+        param->setValue(middle + (max - middle) * (float(mean_value) / 100.0));
+    }
 }
@@ -5,6 +5,8 @@
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
 #include "MapButton.h"
+#include "MeterDisplay.h"
+#include "SpectrumDisplay.h"
 //==============================================================================
 /**
 */
@@ -37,6 +39,26 @@ public:
     void initialize_mapping_buttons();
     void resize_mapping_buttons();
 
+    void initialize_meters();
+    void resize_meters();
+
+    void initialize_analyser();
+    void resize_analyser();
+    void initialize_analysis_box(juce::Label& label, juce::ComboBox& box, const juce::String& text, const juce::String& parameterID);
+
+    void initialize_morph();
+    void resize_morph();
+    void update_morph_buttons();
+
+    void initialize_midi();
+    void resize_midi();
+    void update_midi_mappings();
+    void update_midi_mapping_controls();
+
+    void initialize_prediction();
+    void resize_prediction();
+    void update_prediction_stats();
+
     //This function is used by "MAP_X" and "MAP_Y" buttons only
     void buttonClicked(juce::Button* button) override;
 
@@ -56,6 +78,11 @@ private:
     juce::Rectangle<int> delayPanel;
     juce::Rectangle<int> volumePanel;
     juce::Rectangle<int> mapPanel;
+    juce::Rectangle<int> meterPanel;
+    juce::Rectangle<int> analyserPanel;
+    juce::Rectangle<int> morphPanel;
+    juce::Rectangle<int> midiPanel;
+    juce::Rectangle<int> predictionPanel;
     
     //Equalizer
     juce::Label eqPanelLabel;
@@ -88,6 +115,28 @@ private:
     juce::Label outPanelLabel;
     juce::Slider outVolumeSlider;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> outVolumeAttach;
+
+    //Level meters
+    juce::Label meterPanelLabel;
+    MeterDisplay meterDisplay;
+
+    //Spectrum analyser. The frame is a member, it is too big for the stack of the timer callback
+    SpectrumDisplay spectrumDisplay;
+    FFTProcessor::Frame spectrumFrame;
+
+    //Analyser settings, one choice parameter each, in a column next to the display
+    juce::Label analysisAggregationLabel, analysisModeLabel, analysisSizeLabel, analysisOverlapLabel;
+    juce::ComboBox analysisAggregationBox, analysisModeBox, analysisSizeBox, analysisOverlapBox;
+    std::vector<std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment>> analysisAttachments;
+
+    //Preset morph: one button per snapshot slot, and the position slider which can be mapped to an axis
+    juce::Label morphPanelLabel;
+    juce::ToggleButton morphOnButton;
+    std::array<juce::TextButton, PresetMorph::maxSnapshots> morphStoreButtons;
+    juce::TextButton morphClearButton;
+    juce::Slider morphPositionSlider;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> morphPositionAttach;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> morphOnAttach;
     
 
     //Parameters to map
@@ -97,10 +146,14 @@ private:
     juce::Slider* param1{ nullptr };
     juce::Slider* param2{ nullptr };
 
-    //"MAP_X" and "MAP_Y" buttons
+    //"MAP 1" and "MAP 2" buttons
     juce::TextButton param1Button;
     juce::TextButton param2Button;
 
+    //Controller and axis driving param1 and param2: item ID 1 + 3 * controller + axis, axis 0, 1, 2 for X, Y, Z
+    juce::ComboBox source1Box;
+    juce::ComboBox source2Box;
+
     //Used to identify param1Button and param2Button
     bool mapParameter1{ false };
     bool mapParameter2{ false };
@@ -112,11 +165,30 @@ private:
     //Buttons for mapping parameters: we have one for each parameter
     
     //EQ
-    MapButton filterCutoffMap{ &filterCutoff }, QMap{ &Q };
+    MapButton filterCutoffMap{ &filterCutoff, "EQcutoff" }, QMap{ &Q, "Q" };
     //Distortion
-    MapButton driveMap{ &driveKnob }, angerMap{ &angerKnob }, distHPFMap{ &HPFKnob }, distLPFMap{ &LPFKnob }, distVolumeMap{ &volumeKnob }, distDryWetMap{ &mixKnob };
+    MapButton driveMap{ &driveKnob, "drive" }, angerMap{ &angerKnob, "anger" }, distHPFMap{ &HPFKnob, "hpf" }, distLPFMap{ &LPFKnob, "lpf" }, distVolumeMap{ &volumeKnob, "volume" }, distDryWetMap{ &mixKnob, "distortion_mix" };
     //Delay
-    MapButton feedbackMap{&delayGain}, delayTimeMap{&delayTime};
+    MapButton feedbackMap{&delayGain, "gain"}, delayTimeMap{&delayTime, "delay_time"};
+    //Morph
+    MapButton morphMap{ &morphPositionSlider, "morph_position" };
+
+    //MIDI learn: after LEARN, the next mapping button clicked picks the parameter,
+    //then the next controller moved is mapped to it
+    juce::Label midiPanelLabel;
+    juce::TextButton midiLearnButton;
+    bool midiLearnArmed{ false };
+    juce::ComboBox midiMappingBox;
+    juce::ComboBox midiCurveBox;
+    juce::Slider midiSmoothingSlider;
+    juce::TextButton midiRemoveButton;
+    int midiMappingsVersion{ -1 };
+
+    //Gesture prediction, with the lag and the errors of the controller of MAP 1
+    juce::Label predictionPanelLabel;
+    juce::ComboBox predictionModeBox;
+    juce::Slider predictionAggressivenessSlider;
+    juce::Label predictionStatsLabel;
 
 
 
@@ -141,5 +213,8 @@ private:
     int timerValue = 25;
     void timerCallback() override;
 
+    //Moves a mapped slider by the mean tilt of its axis, from -100 to 100
+    void applyGesture(juce::Slider* param, float mean_value);
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (EQAudioProcessorEditor)
 };
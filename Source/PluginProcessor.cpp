@@ -2,11 +2,31 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
-const juce::String kSerialPortName{ "\\\\.\\COM3" };
+// The visualizer draws at about 60 fps, there is no point in sending more spectra than that
+const float kSpectrumPublishRateHz{ 60.0f };
+
+// 8-bit dB values in a single OSC blob, about 8 times smaller than one float32 argument per bin
+const SpectrumEncoding kSpectrumEncoding{ SpectrumEncoding::quantized8 };
+const bool kSpectrumDeltaEncoding{ false };
+
+// How often the level meters are sent over OSC
+const int kMeterPublishRateHz{ 20 };
+
+// Anything below this level counts as silence, for sleeping and for the tail length
+const float kSilenceThresholdDb{ -90.0f };
+
+// Largest bus layout accepted by isBusesLayoutSupported, e.g. 7.1.4 or third order ambisonics
+const int kMaxChannels{ 16 };
+static_assert(kMaxChannels <= FFTProcessor::maxChannels, "The spectral stage must handle every accepted layout");
+
+// The host only updates the parameters once per block: the equalizer and the distortion
+// move from the previous values to the new ones in steps of this many samples
+const int kControlBlockSize{ 32 };
+
+// MIDI events closer than this to the start of a chunk are applied at its start,
+// so a dense stream of events doesn't cut the block into tiny chunks
+const int kMinMidiChunk{ 8 };
 
-void EQAudioProcessor::initSerial() {
-    serialDevice.init(kSerialPortName);
-}
 //==============================================================================
 EQAudioProcessor::EQAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -18,11 +38,27 @@ EQAudioProcessor::EQAudioProcessor()
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
                        ),
-                       equalizer_apvts(*this, nullptr), distortion_apvts(*this, nullptr), delay_apvts(*this, nullptr), out_apvts(*this, nullptr)
+                       equalizer_apvts(*this, nullptr), distortion_apvts(*this, nullptr), delay_apvts(*this, nullptr), out_apvts(*this, nullptr),
+                       spectral_apvts(*this, nullptr), modulation_apvts(*this, nullptr), analysis_apvts(*this, nullptr)
 #endif
 {
     
-    initSerial();
+    instanceId = deviceHub->addInstance();
+    fft.setInstanceId(instanceId);
+
+    // The /meters packet is written by hand, see timerCallback(). Its address and type tags never
+    // change: "/meters", then ",i" and "fff" per MeterPoint, null-terminated and padded to 4 bytes.
+    {
+        juce::MemoryOutputStream prefix(meterPacket, false);
+        prefix.write("/meters\0", 8);
+        juce::String tags(",i");
+        for (int point = 0; point < LevelMeters::numPoints; ++point)
+            tags << "fff";
+        prefix.write(tags.toRawUTF8(), size_t(tags.length()));
+        prefix.writeRepeatedByte(0, size_t(4 - tags.length() % 4));
+        meterArgumentsOffset = int(prefix.getPosition());
+        prefix.writeRepeatedByte(0, size_t(4 + LevelMeters::numPoints * 3 * 4));
+    }
 
     //Equalizer parameters
     equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("EQcutoff",
@@ -31,6 +67,25 @@ EQAudioProcessor::EQAudioProcessor()
         "Q", juce::NormalisableRange<float>(0.01f, 10.0f, 0.01f), 2.0f));
     equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("type",
         "Filter Type", filterTypes, 0));
+    equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("eq_bypass",
+        "EQ Bypass", false));
+    const std::array<float, Equalizer::numBands> defaultBandFreqs{ 80.0f, 250.0f, 800.0f, 2500.0f, 6000.0f, 12000.0f };
+    for (int band = 1; band <= Equalizer::numBands; band++) {
+        const juce::String prefix = "eq" + juce::String(band);
+        const juce::String name = "EQ Band " + juce::String(band);
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>(prefix + "_on",
+            name, false));
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>(prefix + "_type",
+            name + " Type", bandTypes, 0));
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>(prefix + "_freq",
+            name + " Frequency", juce::NormalisableRange<float>(20.0f, 20000.0f, 1.0f, 0.25f), defaultBandFreqs[band - 1], "Hz"));
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>(prefix + "_gain",
+            name + " Gain", juce::NormalisableRange<float>(-24.0f, 24.0f, 0.1f), 0.0f, "dB"));
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>(prefix + "_q",
+            name + " Q", juce::NormalisableRange<float>(0.1f, 18.0f, 0.01f, 0.3f), 0.71f));
+        equalizer_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>(prefix + "_slope",
+            name + " Slope", bandSlopes, 1));
+    }
     equalizer_apvts.state = juce::ValueTree("savedParams");
 
     //Distortion parameters
@@ -48,6 +103,24 @@ EQAudioProcessor::EQAudioProcessor()
         "LPF Frequency", juce::NormalisableRange<float>(20.0f, 20000.0f, 1.0f, 0.25f), 20000.0f, "Hz"));
     distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("distortion_type",
         "Distortion Type", distortionTypes, 0));
+    distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("distortion_bypass",
+        "Distortion Bypass", false));
+    distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("distortion_bands",
+        "Distortion Bands", distortionBands, 0));
+    const std::array<float, Crossover::maxBands - 1> defaultCrossovers{ 200.0f, 1000.0f, 5000.0f };
+    for (int k = 0; k < Crossover::maxBands - 1; k++) {
+        distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("xover_" + juce::String(k + 1),
+            "Crossover " + juce::String(k + 1), juce::NormalisableRange<float>(40.0f, 16000.0f, 1.0f, 0.25f), defaultCrossovers[k], "Hz"));
+    }
+    for (int band = 1; band <= Crossover::maxBands; band++) {
+        const juce::String prefix = "band" + juce::String(band);
+        distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>(prefix + "_drive",
+            "Band " + juce::String(band) + " Drive", juce::NormalisableRange<float>(-100.0f, 100.0f, 1.0f), 0.0f));
+        distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>(prefix + "_type",
+            "Band " + juce::String(band) + " Type", distortionTypes, 0));
+        distortion_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>(prefix + "_mix",
+            "Band " + juce::String(band) + " Mix", juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f), 1.0f));
+    }
     distortion_apvts.state = juce::ValueTree("savedParams");
 
     //Delay parameters
@@ -55,16 +128,70 @@ EQAudioProcessor::EQAudioProcessor()
         "Gain", juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.0f));
     delay_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("delay_time",
         "delayTime", juce::NormalisableRange<float>(0, 2000, 50), 500));
+    delay_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("delay_bypass",
+        "Delay Bypass", false));
     delay_apvts.state = juce::ValueTree("savedParams");
 
     //Out parameters
     out_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("out_volume",
         "Out Volume", juce::NormalisableRange<float>(-60.0f, 0.0f, 0.01f), -12.0f));
+    // Off by default, so a new instance adds no latency and sounds as before
+    out_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("limiter_on",
+        "Limiter", false));
+    out_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("limiter_ceiling",
+        "Limiter Ceiling", juce::NormalisableRange<float>(-12.0f, 0.0f, 0.1f), -1.0f, "dBTP"));
     out_apvts.state = juce::ValueTree("savedParams");
+
+    //Spectral effects parameters
+    spectral_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("spectral_on",
+        "Spectral FX", false));
+    spectral_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("spectral_gate",
+        "Spectral Gate", juce::NormalisableRange<float>(-100.0f, 0.0f, 0.5f), -100.0f, "dB"));
+    spectral_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("spectral_reduction",
+        "Gate Reduction", juce::NormalisableRange<float>(-60.0f, 0.0f, 0.5f), -30.0f, "dB"));
+    spectral_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("spectral_freeze",
+        "Spectral Freeze", false));
+    spectral_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("spectral_tilt",
+        "Spectral Tilt", juce::NormalisableRange<float>(-6.0f, 6.0f, 0.1f), 0.0f, "dB/oct"));
+    spectral_apvts.state = juce::ValueTree("savedParams");
+
+    //Envelope follower parameters
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("env_target",
+        "Envelope Target", modulationTargets, 0));
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("env_depth",
+        "Envelope Depth", juce::NormalisableRange<float>(-1.0f, 1.0f, 0.01f), 0.5f));
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("env_attack",
+        "Envelope Attack", juce::NormalisableRange<float>(1.0f, 200.0f, 0.1f, 0.4f), 10.0f, "ms"));
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("env_release",
+        "Envelope Release", juce::NormalisableRange<float>(10.0f, 2000.0f, 1.0f, 0.4f), 200.0f, "ms"));
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("env_filter",
+        "Envelope Filter", juce::NormalisableRange<float>(20.0f, 5000.0f, 1.0f, 0.3f), 100.0f, "Hz"));
+
+    //Preset morph parameters
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterBool>("morph_on",
+        "Morph", false));
+    modulation_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterFloat>("morph_position",
+        "Morph Position", juce::NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
+    modulation_apvts.state = juce::ValueTree("savedParams");
+
+    //Spectrum analyser parameters
+    analysis_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("analysis_mode",
+        "Analysis Input", analysisModes, 0));
+    // Coarse, low-latency analysis during the performance (e.g. 512 points)
+    // or fine analysis during soundcheck (e.g. 8192 points, 8x)
+    analysis_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("analysis_size",
+        "Analysis FFT Size", analysisSizes, 1));
+    analysis_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("analysis_overlap",
+        "Analysis Overlap", analysisOverlaps, 0));
+    analysis_apvts.createAndAddParameter(std::make_unique<juce::AudioParameterChoice>("analysis_aggregation",
+        "Spectrum Aggregation", aggregationModes, 0));
+    analysis_apvts.state = juce::ValueTree("savedParams");
 }
 
 EQAudioProcessor::~EQAudioProcessor()
 {
+    stopTimer();
+    deviceHub->removeInstance(instanceId);
 }
 
 //==============================================================================
@@ -73,6 +200,10 @@ const juce::String EQAudioProcessor::getName() const
     return JucePlugin_Name;
 }
 
+// MIDI controllers can be mapped to any parameter, see MidiMapper.h. The plugin formats only
+// give an effect a MIDI input when the project enables "Plugin MIDI Input", the editor tells
+// the user when it is disabled.
+
 bool EQAudioProcessor::acceptsMidi() const
 {
    #if JucePlugin_WantsMidiInput
@@ -102,7 +233,26 @@ bool EQAudioProcessor::isMidiEffect() const
 
 double EQAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    double tail = 0.0;
+
+    // Every repeat of the feedback delay is `gain` times quieter than the previous one:
+    // count the repeats needed for a full scale signal to go below the silence threshold.
+    const float gain = delay_apvts.getRawParameterValue("gain")->load();
+    const float delayTime = delay_apvts.getRawParameterValue("delay_time")->load();
+    const bool delayBypassed = delay_apvts.getRawParameterValue("delay_bypass")->load() > 0.5f;
+    if (!delayBypassed && gain > 0.0f && delayTime > 0.0f) {
+        if (gain >= 1.0f)
+            return std::numeric_limits<double>::infinity();
+
+        const double repeats = std::ceil(std::log(juce::Decibels::decibelsToGain(kSilenceThresholdDb)) / std::log(gain));
+        tail += repeats * delayTime / 1000.0;
+    }
+
+    // The spectral effects and the limiter hold back their latency
+    if (getSampleRate() > 0.0)
+        tail += getLatencySamples() / getSampleRate();
+
+    return tail;
 }
 
 int EQAudioProcessor::getNumPrograms()
@@ -141,12 +291,55 @@ void EQAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
     mDelayBuffer.setSize(numInputChannels, delayBufferSize);
     //Really important to avoid weird and loud high frequencies scracthes
     mDelayBuffer.clear();
+    mDelayIdleSamples = delayBufferSize;
+    mDelayGain = delay_apvts.getRawParameterValue("gain")->load();
+    mDelayFeedback = mDelayGain;
+    mDelayTime = delay_apvts.getRawParameterValue("delay_time")->load();
+
+    morph.prepare(sampleRate);
+    morphActive = false;
+
+    midiMapper.prepare(sampleRate);
+
+    // The ports and sockets are opened by the first instance that plays in real time,
+    // the offline renderer never needs them
+    if (!isNonRealtime())
+        startDevices();
+
+    sleeping = false;
+    silentSamples = 0;
+
+    equalizerStage.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+    distortionStage.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+    delayStage.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
     
     equalizer.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
     equalizer.setParameters(equalizer_apvts);
 
     distortion.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
     distortion.setParameters(distortion_apvts);
+
+    spectralFx.prepare(sampleRate, numInputChannels);
+    spectralFx.setPublishing(false);
+    spectralFx.setSpectralProcessing(true);
+    spectralFx.setParameters(spectral_apvts);
+    spectralActive = spectral_apvts.getRawParameterValue("spectral_on")->load() > 0.5f;
+
+    limiter.setParameters(out_apvts);
+    limiter.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+    limiterActive = limiter.isEnabled();
+    updateLatency();
+    reportLatency();
+
+    meters.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+
+    envelope.prepare(sampleRate, samplesPerBlock);
+    envelope.setParameters(modulation_apvts);
+
+    analysisBuffer.setSize(2, samplesPerBlock);
+    fft.prepare(sampleRate, analysisBuffer.getNumChannels());
+    fft.setPublishRate(kSpectrumPublishRateHz);
+    fft.setSpectrumEncoding(kSpectrumEncoding, kSpectrumDeltaEncoding);
 }
 
 void EQAudioProcessor::releaseResources()
@@ -163,11 +356,10 @@ bool EQAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
     return true;
   #else
     // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // We support anything from mono to 16 channels (e.g. 7.1, 7.1.4, ambisonics):
+    // the filters and the distortion process the channels in SIMD groups.
+    const int numChannels = layouts.getMainOutputChannelSet().size();
+    if (numChannels < 1 || numChannels > kMaxChannels)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -194,23 +386,315 @@ void EQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::Mid
     for (auto i = getTotalNumInputChannels(); i < getTotalNumOutputChannels(); ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
+    // MIDI mapped parameters: the block is split at the events, and the parameters they
+    // move are set before the chunk that starts there. That chunk is at most kControlBlockSize
+    // long, so the stages that ramp their parameters over a chunk reach the new values within
+    // one control block of the event. While a mapping is smoothing, all the chunks are that short.
+    const bool hasMappings = midiMapper.update();
+    if (!hasMappings && !midiMapper.isLearning()) {
+        processChain(buffer);
+        return;
+    }
+
+    const int numSamples = buffer.getNumSamples();
+    auto event = midiMessages.cbegin();
+    for (int start = 0; start < numSamples;) {
+        // Only short messages can be mapped, a SysEx would be copied to the heap by getMessage()
+        bool handled = false;
+        for (; event != midiMessages.cend() && (*event).samplePosition < start + kMinMidiChunk; ++event)
+            if ((*event).numBytes <= 3) {
+                midiMapper.handleEvent((*event).getMessage());
+                handled = true;
+            }
+        midiMapper.apply();
+
+        int end = numSamples;
+        if (event != midiMessages.cend())
+            end = juce::jmin(end, (*event).samplePosition);
+        if (handled || midiMapper.isSmoothing())
+            end = juce::jmin(end, start + kControlBlockSize);
+
+        juce::AudioBuffer<float> chunk(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, end - start);
+        processChain(chunk);
+        midiMapper.advance(end - start);
+        start = end;
+    }
+}
+
+// This function runs the whole chain over a block, or over a chunk of a block split at MIDI events.
+void EQAudioProcessor::processChain(juce::AudioBuffer<float>& buffer)
+{
+    // While sleeping, silence in gives silence out and the chain is skipped
+    const bool inputSilent = isSilent(buffer);
+    if (inputSilent && sleeping) {
+        buffer.clear();
+        meters.measureSilence(buffer.getNumSamples());
+        meters.publish();
+        return;
+    }
+    sleeping = false;
+
+    meters.measure(MeterPoint::input, buffer);
 
     juce::dsp::AudioBlock<float> block(buffer);
-    juce::dsp::ProcessContextReplacing<float> context(block);
+    const int numSamples = buffer.getNumSamples();
+
+    // Follow the input envelope
+    envelope.setParameters(modulation_apvts);
+    envelope.process(buffer);
 
-    // Equalize
+    // Preset morph: the position moves from where it was at the end of the last block
+    const bool morphOn = morph.update() && modulation_apvts.getRawParameterValue("morph_on")->load() > 0.5f;
+    const float morphEnd = modulation_apvts.getRawParameterValue("morph_position")->load();
+    const float morphStart = morphActive ? morphPosition : morphEnd;
+    morphActive = morphOn;
+    morphPosition = morphEnd;
+
+    // Equalize, ramping the parameters over the block. While morphing, the coefficients
+    // are blended from the snapshots instead.
     equalizer.setParameters(equalizer_apvts);
-    equalizer.process(context);
+    const bool eqBypassed = equalizer_apvts.getRawParameterValue("eq_bypass")->load() > 0.5f;
+    for (int start = 0; start < numSamples; start += kControlBlockSize) {
+        const int length = juce::jmin(kControlBlockSize, numSamples - start);
+        auto subBlock = block.getSubBlock(static_cast<size_t>(start), static_cast<size_t>(length));
+        const float position = float(start + length) / float(numSamples);
+
+        equalizer.rampParameters(position);
+        if (morphOn) {
+            const auto segment = morph.getSegment(juce::jmap(position, morphStart, morphEnd));
+            equalizer.setMorph(segment.from->equalizerSections, segment.to->equalizerSections, segment.position);
+        }
+        else
+            equalizer.setCutoff(envelope.modulate(ModulationTarget::eqCutoff, equalizer_apvts, "EQcutoff", float(equalizer.getCutoff()), start));
+        if (equalizerStage.begin(!eqBypassed && !equalizer.isNeutral(), subBlock)) {
+            equalizer.process(juce::dsp::ProcessContextReplacing<float>(subBlock));
+            equalizerStage.end(subBlock);
+        }
+    }
+    meters.measure(MeterPoint::equalizer, buffer);
 
-    // Distort
+    // Distort, ramping the parameters over the block
     distortion.setParameters(distortion_apvts);
-    distortion.process(context);
+    const bool distortionBypassed = distortion_apvts.getRawParameterValue("distortion_bypass")->load() > 0.5f;
+    for (int start = 0; start < numSamples; start += kControlBlockSize) {
+        const int length = juce::jmin(kControlBlockSize, numSamples - start);
+        auto subBlock = block.getSubBlock(static_cast<size_t>(start), static_cast<size_t>(length));
+        const float position = float(start + length) / float(numSamples);
+
+        distortion.rampParameters(position);
+        if (morphOn) {
+            const auto segment = morph.getSegment(juce::jmap(position, morphStart, morphEnd));
+            distortion.setMorph(segment.from->distortion, segment.to->distortion,
+                                segment.from->distortionFilters, segment.to->distortionFilters, segment.position);
+        }
+        distortion.setDrive(envelope.modulate(ModulationTarget::drive, distortion_apvts, "drive", distortion.getDrive(), start));
+        distortion.setMix(envelope.modulate(ModulationTarget::distortionMix, distortion_apvts, "distortion_mix", distortion.getMix(), start));
+        if (distortionStage.begin(!distortionBypassed && !distortion.isNeutral(), subBlock)) {
+            distortion.process(juce::dsp::ProcessContextReplacing<float>(subBlock));
+            distortionStage.end(subBlock);
+        }
+    }
+    meters.measure(MeterPoint::distortion, buffer);
+
+    // Spectral effects
+    const bool spectralOn = spectral_apvts.getRawParameterValue("spectral_on")->load() > 0.5f;
+    if (spectralOn != spectralActive) {
+        // Start from empty FIFOs, so no stale audio comes out when the stage is enabled again
+        spectralActive = spectralOn;
+        spectralFx.reset();
+    }
+    if (spectralActive) {
+        spectralFx.setParameters(spectral_apvts);
+        spectralFx.processBlock(buffer.getArrayOfWritePointers(), getTotalNumInputChannels(), buffer.getNumSamples(), false);
+    }
+    meters.measure(MeterPoint::spectral, buffer);
 
 
     // Delay
+    mDelayFeedback = delay_apvts.getRawParameterValue("gain")->load();
+    mDelayTime = delay_apvts.getRawParameterValue("delay_time")->load();
+    if (morphOn) {
+        const auto segment = morph.getSegment(morphEnd);
+        mDelayFeedback = juce::jmap(segment.position, segment.from->delayGain, segment.to->delayGain);
+        mDelayTime = juce::jmap(segment.position, segment.from->delayTime, segment.to->delayTime);
+    }
+    processDelay(buffer);
+    meters.measure(MeterPoint::delay, buffer);
+
+    // Go to sleep once input and output have been silent for longer than the longest tail
+    if (inputSilent && isSilent(buffer))
+        silentSamples += buffer.getNumSamples();
+    else
+        silentSamples = 0;
+
+    if (silentSamples > getSilenceHoldSamples())
+        goToSleep();
+
+    // Overall Gain and limiter
+    auto outParameters = Limiter::readParameters(out_apvts);
+    if (morphOn) {
+        const auto segment = morph.getSegment(morphEnd);
+        outParameters.outputGainDb = juce::jmap(segment.position, segment.from->outVolume, segment.to->outVolume);
+        outParameters.ceilingDb = juce::jmap(segment.position, segment.from->limiterCeiling, segment.to->limiterCeiling);
+    }
+    limiter.setParameters(outParameters);
+    if (limiter.isEnabled() != limiterActive) {
+        limiterActive = limiter.isEnabled();
+        limiter.reset();
+    }
+    limiter.process(buffer);
+    updateLatency();
+
+    meters.measure(MeterPoint::output, buffer);
+    meters.publish();
+
+    if (analysisEnabled)
+        analyseSpectrum(buffer);
+}
+
+// The parameter with this ID, whichever of the trees it belongs to
+juce::RangedAudioParameter* EQAudioProcessor::findParameter(const juce::String& parameterID) {
+    for (const auto& tree : getParameterTrees())
+        if (auto* parameter = tree.second->getParameter(parameterID))
+            return parameter;
+    return nullptr;
+}
+
+std::atomic<float>* EQAudioProcessor::findRawParameterValue(const juce::String& parameterID) {
+    for (const auto& tree : getParameterTrees())
+        if (auto* value = tree.second->getRawParameterValue(parameterID))
+            return value;
+    return nullptr;
+}
+
+// The next controller moved is mapped to this parameter, see MidiMapper.h
+void EQAudioProcessor::startMidiLearn(const juce::String& parameterID) {
+    auto* parameter = findParameter(parameterID);
+    auto* rawValue = findRawParameterValue(parameterID);
+    if (parameter != nullptr && rawValue != nullptr)
+        midiMapper.startLearn(parameter, rawValue);
+}
+
+// Takes a snapshot of the parameters of the equalizer, distortion, delay and output stages for the morph
+void EQAudioProcessor::storeMorphSnapshot(int slot) {
+    if (slot < 0 || slot >= PresetMorph::maxSnapshots)
+        return;
+
+    MorphSnapshot snapshot{};
+    Equalizer::readParameters(equalizer_apvts, snapshot.equalizer, snapshot.bands);
+    snapshot.distortion = Distortion::readParameters(distortion_apvts);
+    snapshot.delayGain = delay_apvts.getRawParameterValue("gain")->load();
+    snapshot.delayTime = delay_apvts.getRawParameterValue("delay_time")->load();
+    snapshot.outVolume = out_apvts.getRawParameterValue("out_volume")->load();
+    snapshot.limiterCeiling = out_apvts.getRawParameterValue("limiter_ceiling")->load();
+    morph.store(slot, snapshot);
+}
+
+// This function computes the latency of the spectral effects and the limiter, on the audio thread.
+// setLatencySamples() calls into the host, so reportLatency() passes it on from the message thread.
+void EQAudioProcessor::updateLatency() {
+    pendingLatency = (spectralActive ? spectralFx.getLatencyInSamples() : 0)
+                   + (limiterActive ? limiter.getLatencyInSamples() : 0);
+}
+
+// This function reports the latency to the host, only when it changes.
+void EQAudioProcessor::reportLatency() {
+    const int latency = pendingLatency.load();
+    if (latency != getLatencySamples())
+        setLatencySamples(latency);
+}
+
+// This function builds the signal selected by the analysis_mode parameter and sends it to the spectrum analyser.
+// Blocks larger than the one announced in prepareToPlay are analysed in chunks, so nothing is allocated.
+void EQAudioProcessor::analyseSpectrum(const juce::AudioBuffer<float>& buffer) {
+
+    const int numChannels = buffer.getNumChannels();
+    const int chunkLength = analysisBuffer.getNumSamples();
+    if (numChannels == 0 || chunkLength == 0)
+        return;
+
+    const auto mode = static_cast<AnalysisMode>(juce::roundToInt(analysis_apvts.getRawParameterValue("analysis_mode")->load()));
+    const int sizeIndex = juce::roundToInt(analysis_apvts.getRawParameterValue("analysis_size")->load());
+    const int overlapIndex = juce::roundToInt(analysis_apvts.getRawParameterValue("analysis_overlap")->load());
+    fft.setResolution(FFTProcessor::minFftOrder + sizeIndex, 4 << overlapIndex);
+    fft.setAggregation(static_cast<FFTProcessor::SpectrumAggregation>(
+        juce::roundToInt(analysis_apvts.getRawParameterValue("analysis_aggregation")->load())));
+
+    for (int start = 0; start < buffer.getNumSamples(); start += chunkLength) {
+        const int numSamples = juce::jmin(chunkLength, buffer.getNumSamples() - start);
+
+        const float* left = buffer.getReadPointer(0, start);
+        const float* right = buffer.getReadPointer(numChannels > 1 ? 1 : 0, start);
+        float* first = analysisBuffer.getWritePointer(0);
+        float* second = analysisBuffer.getWritePointer(1);
+        int numAnalysisChannels = 1;
+
+        switch (mode)
+        {
+        case AnalysisMode::left:
+            juce::FloatVectorOperations::copy(first, left, numSamples);
+            break;
+        case AnalysisMode::right:
+            juce::FloatVectorOperations::copy(first, right, numSamples);
+            break;
+        case AnalysisMode::mid:
+            juce::FloatVectorOperations::add(first, left, right, numSamples);
+            juce::FloatVectorOperations::multiply(first, 0.5f, numSamples);
+            break;
+        case AnalysisMode::side:
+            juce::FloatVectorOperations::subtract(first, left, right, numSamples);
+            juce::FloatVectorOperations::multiply(first, 0.5f, numSamples);
+            break;
+        case AnalysisMode::stereo:
+            juce::FloatVectorOperations::copy(first, left, numSamples);
+            juce::FloatVectorOperations::copy(second, right, numSamples);
+            numAnalysisChannels = 2;
+            break;
+        }
+
+        fft.processBlock(analysisBuffer.getArrayOfWritePointers(), numAnalysisChannels, numSamples, false);
+    }
+}
+
+
+// This function runs the feedback delay, unless it is bypassed or its buffer only contains silence.
+void EQAudioProcessor::processDelay(juce::AudioBuffer<float>& buffer) {
+
+    const int bufferLength = buffer.getNumSamples();
+    // Feedback gain ramped from the value of the previous block to the one at the end of this block
+    const float startGain = mDelayGain;
+    const float gain = envelope.modulate(ModulationTarget::delayGain, delay_apvts, "gain", mDelayFeedback, bufferLength - 1);
+    mDelayGain = gain;
+    const bool delayBypassed = delay_apvts.getRawParameterValue("delay_bypass")->load() > 0.5f;
+
+    // The stage keeps the dry signal of its fades in a buffer of the block size announced to
+    // prepareToPlay, a larger block goes through in chunks of that size
+    const int maxChunk = juce::jmax(1, delayStage.getMaxBlockSize());
+    for (int start = 0; start < bufferLength; start += maxChunk) {
+        const int length = juce::jmin(maxChunk, bufferLength - start);
+        juce::AudioBuffer<float> chunk(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, length);
+        processDelayChunk(chunk, juce::jmap(float(start) / float(bufferLength), startGain, gain),
+                          juce::jmap(float(start + length) / float(bufferLength), startGain, gain), delayBypassed);
+    }
+}
+
+// This function runs the delay over a chunk of at most the block size of prepareToPlay,
+// the feedback gain going from startGain to gain.
+void EQAudioProcessor::processDelayChunk(juce::AudioBuffer<float>& buffer, const float startGain, const float gain, const bool delayBypassed) {
+
     const int bufferLength = buffer.getNumSamples();
     const int delayBufferLength = mDelayBuffer.getNumSamples();
-    
+    const bool delayNeutral = gain <= 0.0f && mDelayIdleSamples >= delayBufferLength;
+
+    juce::dsp::AudioBlock<float> block(buffer);
+    if (!delayStage.begin(!delayBypassed && !delayNeutral, block)) {
+        // Once the fade out is over, drop the echoes so they don't come back when the delay is enabled again
+        if (mDelayIdleSamples < delayBufferLength) {
+            mDelayBuffer.clear();
+            mDelayIdleSamples = delayBufferLength;
+        }
+        return;
+    }
 
     for (int channel = 0; channel < getTotalNumInputChannels(); ++channel) {
 
@@ -219,11 +703,9 @@ void EQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::Mid
         const float* bufferData = buffer.getReadPointer(channel);
         const float* delayBufferData = mDelayBuffer.getReadPointer(channel);
 
-        const float gain = delay_apvts.getRawParameterValue("gain")->load();
-
-        fillDelayBuffer(channel, bufferLength, delayBufferLength, bufferData, delayBufferData, gain);
+        fillDelayBuffer(channel, bufferLength, delayBufferLength, bufferData, delayBufferData, startGain, gain);
         getFromDelayBuffer(buffer, channel, bufferLength, delayBufferLength, bufferData, delayBufferData);
-        feedbackDelay(channel, bufferLength, delayBufferLength, dryBuffer, gain);
+        feedbackDelay(channel, bufferLength, delayBufferLength, dryBuffer, startGain, gain);
     }
     mWritePosition += bufferLength;
 
@@ -231,39 +713,114 @@ void EQAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::Mid
     //we start from the beginning again
     mWritePosition %= delayBufferLength;
 
-    // Overall Gain
+    mDelayIdleSamples = gain > 0.0f ? 0 : juce::jmin(delayBufferLength, mDelayIdleSamples + bufferLength);
 
-    float overallGain = out_apvts.getRawParameterValue("out_volume")->load();
-    overallGain = std::pow(10, overallGain / 20.0);
-    for (int channel = 0; channel < getNumInputChannels(); ++channel) {
-        auto* channelData = buffer.getWritePointer(channel);
-        for (int sample = 0; sample < buffer.getNumSamples(); ++sample) {
-            channelData[sample] = buffer.getSample(channel, sample) * overallGain;
-        }
+    delayStage.end(block);
+}
+
+// True if every channel of the buffer is below the silence threshold
+bool EQAudioProcessor::isSilent(const juce::AudioBuffer<float>& buffer) const {
+    const float threshold = juce::Decibels::decibelsToGain(kSilenceThresholdDb);
+    for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+        if (buffer.getMagnitude(channel, 0, buffer.getNumSamples()) > threshold)
+            return false;
     }
+    return true;
+}
 
-    
-    float* channelL = buffer.getWritePointer(0);
-    juce::AudioBuffer<float> channelLCopy(1, buffer.getNumSamples());
-    channelLCopy.copyFrom(0, 0, buffer, 0, 0, buffer.getNumSamples());
-    fft.processBlock(channelLCopy.getWritePointer(0), bufferLength, false);
+// How long the output has to stay silent before sleeping: a silent stretch as long as the
+// delay time means the delay buffer only holds silence, plus the latency and a margin
+// for the filters to ring out.
+int EQAudioProcessor::getSilenceHoldSamples() const {
+    double holdSeconds = 0.05;
+
+    // mDelayGain includes the envelope modulation, which can feed back with `gain` at 0,
+    // and echoes fed back earlier are still in the buffer until it has been idle for its length
+    if (juce::jmax(mDelayFeedback, mDelayGain) > 0.0f || mDelayIdleSamples < mDelayBuffer.getNumSamples())
+        holdSeconds += mDelayTime / 1000.0;
+
+    return static_cast<int>(holdSeconds * getSampleRate()) + pendingLatency.load();
+}
+
+// Drops whatever is left below the silence threshold, so the chain wakes up from a clean state
+void EQAudioProcessor::goToSleep() {
+    sleeping = true;
+    silentSamples = 0;
+
+    mDelayBuffer.clear();
+    mDelayIdleSamples = mDelayBuffer.getNumSamples();
+    spectralFx.reset();
+}
+
+// Opens the devices shared by the instances, see DeviceHub::start(), and starts sending the meters.
+void EQAudioProcessor::startDevices() {
+    deviceHub->start();
+    if (!isTimerRunning())
+        startTimerHz(kMeterPublishRateHz);
+}
+
+// Sends the level meters on /meters: the instance ID, then peak, RMS and short-term loudness
+// of each MeterPoint, in processing order (all in dB, loudness in LUFS).
+// Also turns the MIDI event captured while learning into a mapping, and passes the values
+// of the MIDI mapped parameters and the latency to the host.
+void EQAudioProcessor::timerCallback() {
+    midiMapper.commitLearn();
+    midiMapper.notifyHost();
+    reportLatency();
+
+    LevelMeters::Readings readings;
+    if (!meters.read(readings))
+        return;
+
+    // The arguments are big-endian, after the prefix written by the constructor. Sent as a
+    // ready packet: OSCSender would allocate, and the audio threads share the socket lock.
+    auto* arguments = static_cast<uint8_t*>(meterPacket.getData()) + meterArgumentsOffset;
+    const auto writeArgument = [&arguments](uint32_t value) {
+        const uint32_t bigEndian = juce::ByteOrder::swapIfLittleEndian(value);
+        std::memcpy(arguments, &bigEndian, 4);
+        arguments += 4;
+    };
+    const auto writeFloat = [&writeArgument](float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, 4);
+        writeArgument(bits);
+    };
+
+    writeArgument(static_cast<uint32_t>(instanceId));
+    for (const auto& reading : readings) {
+        writeFloat(reading.peakDb);
+        writeFloat(reading.rmsDb);
+        writeFloat(reading.loudness);
+    }
+    deviceHub->sendOscPacket(meterPacket.getData(), int(meterPacket.getSize()));
 }
 
+bool EQAudioProcessor::isStageProcessing(Stage stage) const {
+    switch (stage)
+    {
+    case Stage::equalizer:  return equalizerStage.isProcessing();
+    case Stage::distortion: return distortionStage.isProcessing();
+    case Stage::spectral:   return spectralActive;
+    case Stage::delay:      return delayStage.isProcessing();
+    }
+    return false;
+}
 
 // This function copies the input signal into the delayBufferData
 void EQAudioProcessor::fillDelayBuffer(int channel, const int bufferLength, const int delayBufferLength,
-    const float* bufferData, const float* delayBufferData, const float gain) {
+    const float* bufferData, const float* delayBufferData, const float startGain, const float endGain) {
 
     if (delayBufferLength > bufferLength + mWritePosition) {
-        mDelayBuffer.copyFromWithRamp(channel, mWritePosition, bufferData, bufferLength, gain, gain);
+        mDelayBuffer.copyFromWithRamp(channel, mWritePosition, bufferData, bufferLength, startGain, endGain);
 
     }
     else {
         //In this case, i have to copy some samples at the end of the buffer, and the rest
-        //at the beginning of the buffer.
+        //at the beginning of the buffer. The gain ramp is split at the same point.
         const int bufferRemaining = delayBufferLength - mWritePosition;
-        mDelayBuffer.copyFromWithRamp(channel, mWritePosition, bufferData, bufferRemaining, gain, gain);
-        mDelayBuffer.copyFromWithRamp(channel, 0, bufferData, bufferLength - bufferRemaining, gain, gain);
+        const float splitGain = juce::jmap(float(bufferRemaining) / float(bufferLength), startGain, endGain);
+        mDelayBuffer.copyFromWithRamp(channel, mWritePosition, bufferData, bufferRemaining, startGain, splitGain);
+        mDelayBuffer.copyFromWithRamp(channel, 0, bufferData + bufferRemaining, bufferLength - bufferRemaining, splitGain, endGain);
     }
 }
 
@@ -271,7 +828,7 @@ void EQAudioProcessor::fillDelayBuffer(int channel, const int bufferLength, cons
 void EQAudioProcessor::getFromDelayBuffer(juce::AudioBuffer<float>& buffer, int channel, const int bufferLength, const int delayBufferLength,
     const float* bufferData, const float* delayBufferData) {
 
-    int delayTime = delay_apvts.getRawParameterValue("delay_time")->load(); ;
+    int delayTime = mDelayTime;
     const int readPosition = static_cast<int>(delayBufferLength + mWritePosition - (getSampleRate() * delayTime / 1000))%delayBufferLength;
 
     if(delayBufferLength > bufferLength + readPosition)
@@ -286,16 +843,17 @@ void EQAudioProcessor::getFromDelayBuffer(juce::AudioBuffer<float>& buffer, int
 }
 
 // This function implements a feedback delay. The gain parameter regulates how prolonged the delay is.
-void EQAudioProcessor::feedbackDelay(int channel, const int bufferLength, const int delayBufferLength, float* dryBuffer, const float gain) {
+void EQAudioProcessor::feedbackDelay(int channel, const int bufferLength, const int delayBufferLength, float* dryBuffer,
+    const float startGain, const float endGain) {
 
     if (delayBufferLength > bufferLength + mWritePosition) {
-        mDelayBuffer.addFromWithRamp(channel, mWritePosition, dryBuffer, bufferLength, gain, gain);
+        mDelayBuffer.addFromWithRamp(channel, mWritePosition, dryBuffer, bufferLength, startGain, endGain);
     }
     else {
         const int bufferRemaining = delayBufferLength - mWritePosition;
-        mDelayBuffer.addFromWithRamp(channel, bufferRemaining, dryBuffer, bufferRemaining, gain, gain);
-        mDelayBuffer.addFromWithRamp(channel, 0, dryBuffer, bufferLength - bufferRemaining, gain, gain);
-        //mDelayBuffer.addFromWithRamp()
+        const float splitGain = juce::jmap(float(bufferRemaining) / float(bufferLength), startGain, endGain);
+        mDelayBuffer.addFromWithRamp(channel, mWritePosition, dryBuffer, bufferRemaining, startGain, splitGain);
+        mDelayBuffer.addFromWithRamp(channel, 0, dryBuffer + bufferRemaining, bufferLength - bufferRemaining, splitGain, endGain);
     }
 }
 
@@ -307,21 +865,84 @@ bool EQAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* EQAudioProcessor::createEditor()
 {
+    // The gestures move the sliders even when the host isn't playing
+    startDevices();
     return new EQAudioProcessorEditor (*this);
 }
 
 //==============================================================================
+// The state of every tree goes into a child named after it, the trees all share the "savedParams" type.
+// The MIDI mappings follow, with their parameter IDs.
 void EQAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    juce::ValueTree state("FloatFXState");
+    for (const auto& tree : getParameterTrees()) {
+        juce::ValueTree child(tree.first);
+        child.appendChild(tree.second->copyState(), nullptr);
+        state.appendChild(child, nullptr);
+    }
+
+    juce::ValueTree mappings("midiMappings");
+    for (int i = 0; i < midiMapper.getNumMappings(); ++i) {
+        const auto mapping = midiMapper.getMapping(i);
+        juce::ValueTree child("mapping");
+        child.setProperty("source", static_cast<int>(mapping.type), nullptr);
+        child.setProperty("channel", mapping.channel, nullptr);
+        child.setProperty("number", mapping.number, nullptr);
+        child.setProperty("parameter", mapping.parameter->getParameterID(), nullptr);
+        child.setProperty("curve", static_cast<int>(mapping.curve), nullptr);
+        child.setProperty("smoothing", mapping.smoothingMs, nullptr);
+        mappings.appendChild(child, nullptr);
+    }
+    state.appendChild(mappings, nullptr);
+
+    if (auto xml = state.createXml())
+        copyXmlToBinary(*xml, destData);
 }
 
+// Trees missing from the state (e.g. saved by an older version) keep their current values
 void EQAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    const auto xml = getXmlFromBinary(data, sizeInBytes);
+    if (xml == nullptr)
+        return;
+
+    const auto state = juce::ValueTree::fromXml(*xml);
+    if (!state.hasType("FloatFXState"))
+        return;
+
+    for (const auto& tree : getParameterTrees()) {
+        const auto child = state.getChildWithName(tree.first);
+        if (child.getNumChildren() > 0)
+            tree.second->replaceState(child.getChild(0).createCopy());
+    }
+
+    // Mappings of parameters that no longer exist are dropped
+    const auto mappings = state.getChildWithName("midiMappings");
+    if (mappings.isValid()) {
+        midiMapper.clear();
+        for (const auto& child : mappings) {
+            const juce::String parameterID = child["parameter"];
+            auto* parameter = findParameter(parameterID);
+            auto* rawValue = findRawParameterValue(parameterID);
+            if (parameter == nullptr || rawValue == nullptr)
+                continue;
+
+            const MidiMapping mapping{ static_cast<MidiSourceType>(juce::jlimit(0, 2, int(child["source"]))),
+                                       juce::jlimit(0, 16, int(child["channel"])), juce::jlimit(0, 127, int(child["number"])),
+                                       parameter, rawValue,
+                                       static_cast<MidiCurve>(juce::jlimit(0, MidiMapper::curveNames.size() - 1, int(child["curve"]))),
+                                       juce::jlimit(0.0f, 500.0f, float(child["smoothing"])) };
+            midiMapper.add(mapping);
+        }
+    }
+}
+
+std::array<std::pair<juce::Identifier, juce::AudioProcessorValueTreeState*>, 7> EQAudioProcessor::getParameterTrees()
+{
+    return { { { "equalizer", &equalizer_apvts }, { "distortion", &distortion_apvts }, { "delay", &delay_apvts },
+               { "out", &out_apvts }, { "spectral", &spectral_apvts }, { "modulation", &modulation_apvts },
+               { "analysis", &analysis_apvts } } };
 }
 
 //==============================================================================
@@ -4,13 +4,38 @@
 #include <JuceHeader.h>
 #include "Equalizer.h"
 #include "Distortion.h"
-#include "SerialDevice.h"
+#include "DeviceHub.h"
+#include "StageBypass.h"
 #include "FFTProcessor.h"
+#include "Limiter.h"
+#include "LevelMeter.h"
+#include "EnvelopeFollower.h"
+#include "PresetMorph.h"
+#include "MidiMapper.h"
+
+// The stages of the effect chain, in processing order.
+enum class Stage
+{
+    equalizer,
+    distortion,
+    spectral,
+    delay
+};
+
+// Which signal the spectrum analyser looks at, in the order of the analysis_mode choices.
+enum class AnalysisMode
+{
+    left,
+    right,
+    mid,        // (L + R) / 2
+    side,       // (L - R) / 2
+    stereo      // left and right analysed and published separately
+};
 
 //==============================================================================
 /**
 */
-class EQAudioProcessor  : public juce::AudioProcessor
+class EQAudioProcessor  : public juce::AudioProcessor, private juce::Timer
 {
 public:
     //==============================================================================
@@ -50,11 +75,59 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    // True if the stage ran its DSP in the last block: stages that are bypassed, or that
+    // would not change the signal (e.g. a fully dry distortion), are skipped. For profiling.
+    bool isStageProcessing(Stage stage) const;
+
+    // True while the input is silent and every tail has decayed: the chain is skipped
+    // and the output is silence until some signal comes in again.
+    bool isSleeping() const { return sleeping; }
+
+    // Last level readings published by the audio thread, see LevelMeter.h. Lock-free,
+    // can be called from any thread.
+    bool getMeterReadings(LevelMeters::Readings& readings) const { return meters.read(readings); }
+
+    // The offline renderer turns the analyser off, nobody looks at the spectra there.
+    void setSpectrumAnalysisEnabled(bool shouldAnalyse) { analysisEnabled = shouldAnalyse; }
+
+    // Spectra for the analyser in the editor, read from a lock-free FIFO filled by the
+    // audio thread. Must always be called from the same thread (the editor timer).
+    bool popSpectrumFrame(FFTProcessor::Frame& frame) { return fft.popFrame(frame); }
+
+    // Preset morphing, see PresetMorph.h. Stores the current parameters of the equalizer,
+    // distortion, delay and output stages in a slot (0 to PresetMorph::maxSnapshots - 1).
+    // Message thread.
+    void storeMorphSnapshot(int slot);
+    void clearMorphSnapshots() { morph.clear(); }
+    bool isMorphSnapshotStored(int slot) const { return morph.isStored(slot); }
+
+    // MIDI learn and the mappings of MIDI controllers to parameters, see MidiMapper.h.
+    // Only the message thread functions of MidiMapper are to be called from outside.
+    MidiMapper& getMidiMapper() { return midiMapper; }
+    void startMidiLearn(const juce::String& parameterID);
+    juce::RangedAudioParameter* findParameter(const juce::String& parameterID);
+
+    // Latency of the stages enabled in the last block. The host is told by the timer,
+    // so getLatencySamples() can lag behind it. Any thread.
+    int getCurrentLatencySamples() const { return pendingLatency; }
+
     //===== FOR ARDUINO =======
-    void initSerial();
-    
-    //To read data from Arduino
-    SerialDevice serialDevice;
+    // The serial ports and the OSC gesture input are shared by all the instances through
+    // the DeviceHub, each instance reads its own copy of the messages of every controller.
+    // Nothing is opened until the first prepareToPlay in real time or the first editor.
+    void startDevices();
+    bool isGestureInputConnected() const { return deviceHub->isGestureInputConnected(); }
+
+    //To read data from Arduino, controller by controller
+    bool popSensorMessage(int controller, Message& message) { return deviceHub->popMessage(instanceId, controller, message); }
+
+    // Gesture prediction, shared by all the instances, see GesturePredictor.h
+    void setGesturePrediction(PredictionMode mode, float aggressiveness) { deviceHub->setPrediction(mode, aggressiveness); }
+    PredictionMode getGesturePredictionMode() const { return deviceHub->getPredictionMode(); }
+    float getGesturePredictionAggressiveness() const { return deviceHub->getPredictionAggressiveness(); }
+    void reportGestureLatency(float latencyMs) { deviceHub->reportGestureLatency(latencyMs); }
+    float getGestureLatency() const { return deviceHub->getGestureLatency(); }
+    const PredictionErrors& getGesturePredictionErrors(int controller) const { return deviceHub->getPredictionErrors(controller); }
 
     //=========================
 
@@ -65,29 +138,116 @@ public:
     juce::AudioProcessorValueTreeState distortion_apvts;
     juce::AudioProcessorValueTreeState delay_apvts;
     juce::AudioProcessorValueTreeState out_apvts;
+    juce::AudioProcessorValueTreeState spectral_apvts;
+    juce::AudioProcessorValueTreeState modulation_apvts;
+    juce::AudioProcessorValueTreeState analysis_apvts;
+
+    // Every tree with the name its state is saved under
+    std::array<std::pair<juce::Identifier, juce::AudioProcessorValueTreeState*>, 7> getParameterTrees();
 
 private:
-    
+
+    // Serial device and OSC socket shared with the other instances
+    juce::SharedResourcePointer<DeviceHub> deviceHub;
+    int instanceId{ -1 };
+
+    // Click-free switching of each stage, see StageBypass.h
+    StageBypass equalizerStage, distortionStage, delayStage;
+
+    // Envelope follower on the input, routed to one of the parameters of the chain
+    EnvelopeFollower envelope;
+    const juce::StringArray modulationTargets{ "None", "EQ Cutoff", "Drive", "Distortion Mix", "Delay Gain" };
+
+    // Preset morph, and the position it was at the end of the last block (audio thread)
+    PresetMorph morph;
+    bool morphActive{ false };
+    float morphPosition{ 0.0f };
+
+    // MIDI controllers mapped to parameters
+    MidiMapper midiMapper;
+    std::atomic<float>* findRawParameterValue(const juce::String& parameterID);
+
+    void processChain(juce::AudioBuffer<float>& buffer);
+
     // Equalization
     Equalizer equalizer;
     const juce::StringArray filterTypes{ "LowPass Filter", "HighPass Filter", "BandPass Filter"};
+    const juce::StringArray bandTypes{ "Peak", "Low Shelf", "High Shelf", "Notch", "Low Cut", "High Cut" };
+    const juce::StringArray bandSlopes{ "12 dB/oct", "24 dB/oct", "36 dB/oct", "48 dB/oct" };
 
     // Distortion
     Distortion distortion;
     const juce::StringArray distortionTypes{ "Mode 1", "Mode 2", "Mode 3", "Mode 4" };
+    const juce::StringArray distortionBands{ "1 Band", "2 Bands", "3 Bands", "4 Bands" };
 
     // Delay
     juce::AudioBuffer<float> mDelayBuffer;
     int mWritePosition{ 0 };
 
-    void fillDelayBuffer(int, const int, const int, const float*, const float*, const float);
+    // Samples processed since the feedback gain went to 0: once the whole delay buffer
+    // has been overwritten it only contains zeros and the delay can be skipped.
+    int mDelayIdleSamples{ 0 };
+
+    // Feedback gain at the end of the last block, where the next block's gain ramp starts
+    float mDelayGain{ 0.0f };
+
+    // Delay parameters of the current block, from delay_apvts or from the morph
+    float mDelayFeedback{ 0.0f };
+    float mDelayTime{ 500.0f };
+
+    void processDelay(juce::AudioBuffer<float>& buffer);
+    void processDelayChunk(juce::AudioBuffer<float>& buffer, const float startGain, const float gain, const bool delayBypassed);
+
+    // Silence detection
+    std::atomic<bool> sleeping{ false };
+    int silentSamples{ 0 };
+
+    bool isSilent(const juce::AudioBuffer<float>& buffer) const;
+    int getSilenceHoldSamples() const;
+    void goToSleep();
+
+    void fillDelayBuffer(int, const int, const int, const float*, const float*, const float, const float);
 
     void getFromDelayBuffer(juce::AudioBuffer<float> &, int, const int, const int, const float*, const float*);
 
-    void feedbackDelay(int channel, const int bufferLength, const int delayBufferLength, float* dryBuffer, const float);
+    void feedbackDelay(int channel, const int bufferLength, const int delayBufferLength, float* dryBuffer, const float, const float);
 
 
+    // Spectral effects. The stage adds spectralFx.getLatencyInSamples() of latency
+    // while it is enabled, which is reported to the host.
+    FFTProcessor spectralFx;
+    std::atomic<bool> spectralActive{ false };
+
+    // Output volume and look-ahead limiter, which adds limiter.getLatencyInSamples() while enabled
+    Limiter limiter;
+    std::atomic<bool> limiterActive{ false };
+
+    // Latency of the enabled stages, computed by the audio thread and reported by reportLatency()
+    std::atomic<int> pendingLatency{ 0 };
+    void updateLatency();
+    void reportLatency();
+
+    // Level meters, measured on the audio thread and sent over OSC by timerCallback()
+    LevelMeters meters;
+
+    void timerCallback() override;
+
+    // The OSC packet of /meters, allocated by the constructor: the prefix, then the arguments
+    juce::MemoryBlock meterPacket;
+    int meterArgumentsOffset{ 0 };
+
+    // Spectrum analysis
     FFTProcessor fft;
+    const juce::StringArray aggregationModes{ "Peak Hold", "RMS" };
+    const juce::StringArray analysisModes{ "Left", "Right", "Mid", "Side", "Stereo" };
+    const juce::StringArray analysisSizes{ "512", "1024", "2048", "4096", "8192" };
+    const juce::StringArray analysisOverlaps{ "4x", "8x" };
+    std::atomic<bool> analysisEnabled{ true };
+
+    // Signal(s) sent to the analyser, allocated in prepareToPlay
+    juce::AudioBuffer<float> analysisBuffer;
+
+    void analyseSpectrum(const juce::AudioBuffer<float>& buffer);
    
 
     //==============================================================================
@@ -0,0 +1,126 @@
+/*
+  This class morphs between snapshots of the parameters of the equalizer, the distortion,
+  the delay and the output stage. Up to maxSnapshots snapshots are stored in slots, and a
+  position between 0 and 1 moves across the stored ones in slot order: with N snapshots,
+  the k-th one sits at k / (N - 1). The position is the "morph_position" parameter, which
+  can be mapped to an accelerometer axis like any other slider.
+
+  The filter coefficients of a snapshot are computed when it is stored, on the message
+  thread. The audio thread only blends the coefficients of the two snapshots around the
+  position and interpolates the other parameters. The crossover of the multiband
+  distortion is the exception: its bands only sum back to the input if their sections
+  share the same frequencies, so it is designed again from the interpolated frequencies,
+  and only when they move.
+
+  Stored snapshots reach the audio thread through a SpinLock that the audio thread only
+  tries to take: while a snapshot is being stored, the previous ones are used for one more block.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Equalizer.h"
+#include "Distortion.h"
+
+struct MorphSnapshot {
+    EqualizerParameters equalizer;
+    Equalizer::Bands bands;
+    DistortionParameters distortion;
+    float delayGain, delayTime;
+    float outVolume, limiterCeiling;
+
+    // Computed from the parameters above when the snapshot is stored
+    Equalizer::Sections equalizerSections;
+    Distortion::InputFilters distortionFilters;
+};
+
+class PresetMorph {
+
+public:
+    static constexpr int maxSnapshots = 4;
+
+    // The two snapshots around a position, and where the position is between them (0 to 1)
+    struct Segment {
+        const MorphSnapshot* from;
+        const MorphSnapshot* to;
+        float position;
+    };
+
+    // Computes the coefficients of the stored snapshots again for a new sample rate.
+    void prepare(double newSampleRate)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        sampleRate = newSampleRate;
+        for (int slot = 0; slot < maxSnapshots; slot++)
+            if (pendingStored[slot])
+                computeCoefficients(pending[slot]);
+        pendingChanged = true;
+    }
+
+    // Stores the parameters of a snapshot in a slot and computes its coefficients. Message thread.
+    void store(int slot, const MorphSnapshot& snapshot)
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        pending[slot] = snapshot;
+        computeCoefficients(pending[slot]);
+        pendingStored[slot] = true;
+        pendingChanged = true;
+    }
+
+    void clear()
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        pendingStored.fill(false);
+        pendingChanged = true;
+    }
+
+    bool isStored(int slot) const
+    {
+        const juce::SpinLock::ScopedLockType lock(pendingLock);
+        return pendingStored[slot];
+    }
+
+    // Picks up the snapshots stored since the last call. Audio thread.
+    // Returns true if there are at least two snapshots to morph between.
+    bool update()
+    {
+        if (pendingChanged) {
+            const juce::SpinLock::ScopedTryLockType lock(pendingLock);
+            if (lock.isLocked()) {
+                numActive = 0;
+                for (int slot = 0; slot < maxSnapshots; slot++)
+                    if (pendingStored[slot])
+                        active[numActive++] = pending[slot];
+                pendingChanged = false;
+            }
+        }
+        return numActive >= 2;
+    }
+
+    // Only valid after update() returned true
+    Segment getSegment(float position) const
+    {
+        const float scaled = juce::jlimit(0.0f, 1.0f, position) * float(numActive - 1);
+        const int first = juce::jmin(static_cast<int>(scaled), numActive - 2);
+        return { &active[first], &active[first + 1], scaled - float(first) };
+    }
+
+private:
+    void computeCoefficients(MorphSnapshot& snapshot) const
+    {
+        snapshot.equalizerSections = Equalizer::computeSections(snapshot.equalizer, snapshot.bands, sampleRate);
+        snapshot.distortionFilters = Distortion::computeInputFilters(snapshot.distortion, sampleRate);
+    }
+
+    double sampleRate{ 44100.0 };
+
+    // Written by the message thread under pendingLock
+    std::array<MorphSnapshot, maxSnapshots> pending{};
+    std::array<bool, maxSnapshots> pendingStored{};
+    std::atomic<bool> pendingChanged{ false };
+    mutable juce::SpinLock pendingLock;
+
+    // The stored snapshots in slot order, used by the audio thread
+    std::array<MorphSnapshot, maxSnapshots> active{};
+    int numActive{ 0 };
+};
@@ -0,0 +1,251 @@
+/*
+* Entry point of the command line batch renderer. It is only compiled in the
+* console application target, which defines FLOATFX_RENDER_CLI=1.
+*
+*   FloatFXRender --output <dir> [--threads N] [--block-size N] [--max-tail seconds]
+*                 [--automation curves.json] [--gesture-log log.csv] files...
+*   FloatFXRender --benchmark-instantiation N
+*   FloatFXRender --check-automation
+*   FloatFXRender --check-osc-loopback
+*/
+
+#if FLOATFX_RENDER_CLI
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "OfflineRenderer.h"
+#include "OscGestureReceiver.h"
+#include "PluginProcessor.h"
+
+static int printUsage()
+{
+    std::cout << "Usage: FloatFXRender --output <dir> [--threads N] [--block-size N] [--max-tail seconds]" << std::endl
+              << "                     [--automation curves.json] [--gesture-log log.csv] files..." << std::endl
+              << "       FloatFXRender --benchmark-instantiation N" << std::endl
+              << "       FloatFXRender --check-automation" << std::endl
+              << "       FloatFXRender --check-osc-loopback" << std::endl;
+    return 1;
+}
+
+// Creates and destroys the processor N times, as a host does while scanning or loading a
+// session, and prints how long the constructor, the first prepareToPlay and the destructor take.
+// The processors are prepared in real time mode, like in a host, so prepareToPlay also opens
+// the devices of the DeviceHub, which are closed again with the last instance. The first
+// instance also builds the FFT tables, so it is reported on its own.
+static int benchmarkInstantiation(int numInstances)
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 512;
+    double constructMs = 0.0, prepareMs = 0.0, destructMs = 0.0, maxConstructMs = 0.0, firstPrepareMs = 0.0;
+
+    for (int i = 0; i < numInstances; ++i) {
+        const double start = juce::Time::getMillisecondCounterHiRes();
+        auto processor = std::make_unique<EQAudioProcessor>();
+        const double constructed = juce::Time::getMillisecondCounterHiRes();
+
+        processor->setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor->prepareToPlay(sampleRate, blockSize);
+        const double prepared = juce::Time::getMillisecondCounterHiRes();
+
+        processor.reset();
+        const double destroyed = juce::Time::getMillisecondCounterHiRes();
+
+        constructMs += constructed - start;
+        maxConstructMs = juce::jmax(maxConstructMs, constructed - start);
+        if (i == 0)
+            firstPrepareMs = prepared - constructed;
+        else
+            prepareMs += prepared - constructed;
+        destructMs += destroyed - prepared;
+    }
+
+    const double count = double(numInstances);
+    std::cout << numInstances << " instances, mean times in ms" << std::endl
+              << "  constructor   " << constructMs / count << " (max " << maxConstructMs << ")" << std::endl
+              << "  prepareToPlay " << firstPrepareMs << " the first time";
+    if (numInstances > 1)
+        std::cout << ", then " << prepareMs / (count - 1.0);
+    std::cout << std::endl
+              << "  destructor    " << destructMs / count << std::endl;
+    return 0;
+}
+
+// Renders a sine while the output volume is automated from -60 to 0 dB, the way the
+// renderer applies the curves of --automation, and checks that the output follows it.
+static int checkAutomation()
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 512;
+    const double lengthSeconds = 2.0;
+
+    EQAudioProcessor processor;
+    processor.setSpectrumAnalysisEnabled(false);
+    processor.setNonRealtime(true);
+    processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+    processor.prepareToPlay(sampleRate, blockSize);
+
+    AutomationCurves automation;
+    automation.addPoint("out_volume", 0.0, -60.0f);
+    automation.addPoint("out_volume", lengthSeconds, 0.0f);
+
+    // Levels of the output at the start and at the end, after the latency
+    const int windowLength = static_cast<int>(0.2 * sampleRate);
+    const int startWindow = static_cast<int>(0.1 * sampleRate);
+    const int endWindow = static_cast<int>((lengthSeconds - 0.3) * sampleRate);
+    double startSum = 0.0, endSum = 0.0;
+
+    juce::AudioBuffer<float> buffer(2, blockSize);
+    juce::MidiBuffer midiMessages;
+    const int totalLength = static_cast<int>(lengthSeconds * sampleRate);
+    for (int position = 0; position < totalLength; position += blockSize) {
+        for (int channel = 0; channel < 2; ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                buffer.setSample(channel, i, 0.25f * std::sin(juce::MathConstants<float>::twoPi * 440.0f * float(position + i) / float(sampleRate)));
+
+        automation.apply(processor, static_cast<double>(position) / sampleRate);
+        processor.processBlock(buffer, midiMessages);
+
+        for (int i = 0; i < blockSize; ++i) {
+            const double sample = buffer.getSample(0, i);
+            if (position + i >= startWindow && position + i < startWindow + windowLength)
+                startSum += sample * sample;
+            else if (position + i >= endWindow && position + i < endWindow + windowLength)
+                endSum += sample * sample;
+        }
+    }
+    processor.releaseResources();
+
+    const float startDb = juce::Decibels::gainToDecibels(float(std::sqrt(startSum / windowLength)));
+    const float endDb = juce::Decibels::gainToDecibels(float(std::sqrt(endSum / windowLength)));
+    const bool passed = endDb - startDb > 30.0f;
+    std::cout << (passed ? "PASSED" : "FAILED") << " out_volume automation: " << startDb << " dB at the start, "
+              << endDb << " dB at the end" << std::endl;
+    return passed ? 0 : 1;
+}
+
+// Sends /gesture frames to 127.0.0.1, some pairs swapped, and checks that all of them come
+// out of the jitter buffer in timestamp order, and that the release timer stops afterwards.
+static int checkOscLoopback()
+{
+    const int port = 17772;
+    const int numFrames = 50;
+    const int framePeriodMs = 5;
+
+    // The X value of each frame is its index, the receiver calls back on its timer thread
+    juce::CriticalSection receivedLock;
+    juce::Array<int> received;
+    OscGestureReceiver receiver([&](const Message& message) {
+        if (message.direction == X_AXIS) {
+            const juce::ScopedLock lock(receivedLock);
+            received.add(message.value);
+        }
+    });
+
+    juce::OSCSender sender;
+    if (!receiver.connect(port) || !sender.connect("127.0.0.1", port)) {
+        std::cout << "FAILED can't use UDP port " << port << " on the loopback interface" << std::endl;
+        return 1;
+    }
+
+    for (int frame = 0; frame < numFrames; ++frame) {
+        const int index = frame % 10 == 0 ? frame + 1 : frame % 10 == 1 ? frame - 1 : frame;
+        sender.send(juce::OSCMessage("/gesture", 1, 1000 + index * framePeriodMs, float(index) / 100.0f, 0.0f, 0.0f));
+        juce::Thread::sleep(framePeriodMs);
+    }
+
+    // The last frame is released jitterDelayMs after it was sent
+    const double deadline = juce::Time::getMillisecondCounterHiRes() + 1000.0;
+    int numReceived = 0;
+    while (juce::Time::getMillisecondCounterHiRes() < deadline) {
+        {
+            const juce::ScopedLock lock(receivedLock);
+            numReceived = received.size();
+        }
+        if (numReceived == numFrames && !receiver.isReleasing())
+            break;
+        juce::Thread::sleep(10);
+    }
+    const bool timerStopped = !receiver.isReleasing();
+    receiver.disconnect();
+
+    bool inOrder = numReceived == numFrames;
+    for (int i = 0; inOrder && i < numFrames; ++i)
+        inOrder = received[i] == i;
+
+    const bool passed = inOrder && timerStopped;
+    std::cout << (passed ? "PASSED" : "FAILED") << " OSC loopback: " << numReceived << " of " << numFrames << " frames, "
+              << (inOrder ? "in order" : "out of order") << ", " << receiver.getLateFrames(0) << " late, release timer "
+              << (timerStopped ? "stopped" : "still running") << std::endl;
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    RenderSettings settings;
+    AutomationCurves automation;
+    juce::Array<juce::File> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        const juce::String argument(argv[i]);
+        const bool hasValue = i + 1 < argc;
+
+        if (argument == "--output" && hasValue)
+            settings.outputDirectory = juce::File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        else if (argument == "--threads" && hasValue)
+            settings.numThreads = juce::String(argv[++i]).getIntValue();
+        else if (argument == "--check-automation")
+            return checkAutomation();
+        else if (argument == "--check-osc-loopback")
+            return checkOscLoopback();
+        else if (argument == "--benchmark-instantiation" && hasValue)
+            return benchmarkInstantiation(juce::jmax(1, juce::String(argv[++i]).getIntValue()));
+        else if (argument == "--block-size" && hasValue)
+            settings.blockSize = juce::String(argv[++i]).getIntValue();
+        else if (argument == "--max-tail" && hasValue)
+            settings.maxTailSeconds = juce::jmax(0.0, juce::String(argv[++i]).getDoubleValue());
+        else if ((argument == "--automation" || argument == "--gesture-log") && hasValue) {
+            const juce::File file = juce::File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+            const juce::Result loaded = argument == "--automation" ? automation.loadFromJson(file)
+                                                                   : automation.loadFromGestureLog(file);
+            if (loaded.failed()) {
+                std::cout << loaded.getErrorMessage() << std::endl;
+                return 1;
+            }
+        }
+        else if (argument.startsWith("--"))
+            return printUsage();
+        else
+            inputs.add(juce::File::getCurrentWorkingDirectory().getChildFile(argument));
+    }
+
+    if (settings.outputDirectory == juce::File() || inputs.isEmpty())
+        return printUsage();
+
+    if (!settings.outputDirectory.createDirectory()) {
+        std::cout << "Can't create " << settings.outputDirectory.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    if (!automation.isEmpty())
+        settings.automation = &automation;
+
+    OfflineRenderer renderer(settings);
+    const juce::Array<juce::Result> results = renderer.render(inputs);
+
+    int numFailed = 0;
+    for (int i = 0; i < inputs.size(); ++i) {
+        if (results[i].failed()) {
+            std::cout << "FAILED " << results[i].getErrorMessage() << std::endl;
+            ++numFailed;
+        }
+        else {
+            std::cout << "OK     " << inputs[i].getFullPathName() << std::endl;
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
+
+#endif
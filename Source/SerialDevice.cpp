@@ -5,75 +5,222 @@
 #include <chrono>
 #include "SerialDevice.h"
 
-#define kBPS 9600
-const auto kNumberOfDecimalPlaces { 4 };
+// The firmware boots at kBootBPS sending ASCII lines. Once the port is open, the host asks
+// for binary packets at kStreamBPS and kStreamRateHz. See Arduino/accelerometerConnection.ino.
+const int kBootBPS { 250000 };
+const int kStreamBPS { 1000000 };
+const int kStreamRateHz { 1000 };
+const double kNegotiationTimeoutMs { 300.0 };
+const int kNegotiationAttempts { 3 };
 
+// CONFIRM is sent every kConfirmIntervalMs while streaming. The firmware goes back to kBootBPS
+// after 500 ms without one, so after the ACK the host waits longer, kConfirmTimeoutMs, for the
+// first packet flagged as confirmed.
+const double kConfirmIntervalMs { 100.0 };
+const double kConfirmTimeoutMs { 1000.0 };
 
-// NOTE: This is a very basic protocol without any error checking. To add error checking, you would want to calculate an error check (checksum, crc, etc)
-//       and add that to the end of the packet. On the receiving end you would calculate the error check and compare it to the one sent
+// A binary stream silent for this long has been lost, e.g. the board was reset
+const double kStreamTimeoutMs { 500.0 };
 
-enum ParseState
+const double kExistsCheckMs { 100.0 };
+
+// The serial thread polls the streaming ports every millisecond. While every port is waiting
+// to be opened again, it only wakes up this often, or when open() or close() is called.
+const int kIdleWaitMs { 250 };
+
+// Binary packets: sync bytes, type, flags, sequence, x, y, z, rate, CRC
+const uint8_t kPacketSync1 { 0xA5 };
+const uint8_t kPacketSync2 { 0x5A };
+const uint8_t kPacketSample { 0x01 };
+const uint8_t kPacketAck { 0x02 };
+const uint8_t kPacketFlagPinch { 0x01 };
+const uint8_t kPacketFlagConfirmed { 0x02 };
+
+// Command frames sent to the firmware: start bytes, command, payload size, payload, CRC
+const uint8_t kStartByte1 = '*';
+const uint8_t kStartByte2 = '~';
+const uint8_t kCommandConfigure { 0x10 };
+const uint8_t kCommandConfirm { 0x11 };
+
+// Tilt curve of the firmware: no movement under kTiltMin ADC steps from rest, 100 at kTiltMax
+const int kTiltMin { 50 };
+const int kTiltMax { 220 };
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+static uint16_t crc16 (const uint8_t* data, int length)
 {
-    waitingForStartByte1,
-    waitingForStartByte2,
-    waitingForCommand,
-    waitingForCommandDataSize,
-    waitingForCommandData
-};
-ParseState parseState = waitingForStartByte1;
-// NOTE: the start bytes are used to indicate the start of a packet.
-//       they are arbitrary values, and when you choose them it is better the less likely they will appear in your data together
-const int kStartByte1 = '*';
-const int kStartByte2 = '~';
-
-// NOTE: this is an example of list of command that can be sent and received
-enum Command
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < length; ++i)
+    {
+        crc ^= static_cast<uint16_t> (data[i] << 8);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? static_cast<uint16_t> ((crc << 1) ^ 0x1021) : static_cast<uint16_t> (crc << 1);
+    }
+    return crc;
+}
+
+static uint16_t readUint16 (const uint8_t* data)
 {
-    none,
-    lightColor,
-    tempo,
-    chargingAlarmLevel,
-    endOfList,
-    read
-};
-const int kMaxPayloadSize = 20;
-Command gTestCommandToExecute {Command::lightColor};
-
-SerialDevice::SerialDevice ()
-    : Thread (juce::String ("SerialDevice"))
+    return static_cast<uint16_t> (data[0] | (data[1] << 8));
+}
+
+static int tiltToValue (int delta)
 {
-    // start the serial thread reading data
-    startThread ();
+    delta = std::abs (delta);
+    if (delta < kTiltMin)
+        return 0;
+    const double position = (juce::jmin (delta, kTiltMax) - kTiltMin) / double (kTiltMax - kTiltMin);
+    return juce::roundToInt (100.0 * std::sin (juce::MathConstants<double>::halfPi * position));
+}
 
-    // NOTE: this timer is used to send commands for testing purposes
-    startTimer (500);
+SerialDevice::SerialDevice (std::function<void (const Message&)> onMessageCallback)
+    : Thread (juce::String ("SerialDevice")), onMessage (std::move (onMessageCallback))
+{
 }
 
 SerialDevice::~SerialDevice ()
 {
     stopThread (500);
-    closeSerialPort ();
 }
 
-void SerialDevice::init (juce::String newSerialPortName)
+// Creates the controllers and starts the serial thread reading data. Called once.
+void SerialDevice::init (const juce::StringArray& newSerialPortNames)
 {
-    startTimer(100);
-    serialPortName = newSerialPortName;
-}
+    jassert (numControllers == 0);
+
+    int count = 0;
+    for (const auto& name : newSerialPortNames)
+    {
+        if (count == maxControllers)
+            break;
+        controllers[static_cast<size_t> (count)] = std::make_unique<Controller> (count, name, onMessage);
+        ++count;
+    }
+    numControllers = count;
 
+    // Without a port there is nothing to read, the thread is not even started
+    if (numControllers > 0)
+        startThread ();
+}
 
 void SerialDevice::open (void)
 {
-    if (serialPortName.length () > 0)
-        threadTask = ThreadTask::openSerialPort;
+    for (int controller = 0; controller < numControllers; ++controller)
+        controllers[static_cast<size_t> (controller)]->threadTask = ThreadTask::openSerialPort;
+    notify ();
 }
 
 void SerialDevice::close (void)
 {
-    threadTask = ThreadTask::closeSerialPort;
+    for (int controller = 0; controller < numControllers; ++controller)
+        controllers[static_cast<size_t> (controller)]->threadTask = ThreadTask::closeSerialPort;
+    notify ();
 }
 
-bool SerialDevice::openSerialPort (void)
+bool SerialDevice::isConnected (int controller) const
+{
+    return controller >= 0 && controller < numControllers && controllers[static_cast<size_t> (controller)]->isConnected;
+}
+
+bool SerialDevice::isAnyConnected () const
+{
+    for (int controller = 0; controller < numControllers; ++controller)
+        if (controllers[static_cast<size_t> (controller)]->isConnected)
+            return true;
+    return false;
+}
+
+uint32_t SerialDevice::getDroppedPackets (int controller) const
+{
+    return controller >= 0 && controller < numControllers ? controllers[static_cast<size_t> (controller)]->droppedPackets.load () : 0;
+}
+
+uint32_t SerialDevice::getCorruptedPackets (int controller) const
+{
+    return controller >= 0 && controller < numControllers ? controllers[static_cast<size_t> (controller)]->corruptedPackets.load () : 0;
+}
+
+void SerialDevice::run ()
+{
+    while (!threadShouldExit ())
+    {
+        bool bytesRead = false;
+        bool allWaiting = true;
+        for (int controller = 0; controller < numControllers; ++controller)
+        {
+            auto& serialController = *controllers[static_cast<size_t> (controller)];
+            bytesRead |= serialController.service ();
+            allWaiting = allWaiting && serialController.isWaiting ();
+        }
+
+        if (!bytesRead)
+            wait (allWaiting ? kIdleWaitMs : 1);
+    }
+}
+
+SerialDevice::Controller::Controller (int controllerId, const juce::String& portName, const std::function<void (const Message&)>& onMessageCallback)
+    : id (controllerId), serialPortName (portName), onMessage (onMessageCallback)
+{
+    asciiMessage.controller = id;
+}
+
+SerialDevice::Controller::~Controller ()
+{
+    closeSerialPort ();
+}
+
+bool SerialDevice::Controller::isWaiting (void) const
+{
+    const auto task = threadTask.load ();
+    return task == ThreadTask::delayBeforeOpening || (task == ThreadTask::idle && serialPortName.isEmpty ());
+}
+
+bool SerialDevice::Controller::service (void)
+{
+    switch (threadTask.load ())
+    {
+        case ThreadTask::idle:
+        {
+            if (serialPortName.isNotEmpty ())
+                threadTask = ThreadTask::openSerialPort;
+        }
+        break;
+
+        case ThreadTask::openSerialPort:
+        {
+            if (openSerialPort ())
+            {
+                threadTask = ThreadTask::processSerialPort;
+            }
+            else
+            {
+                threadTask = ThreadTask::delayBeforeOpening;
+                delayStartTime = static_cast<uint64_t>(juce::Time::getMillisecondCounterHiRes ());
+            }
+        }
+        break;
+
+        case ThreadTask::delayBeforeOpening:
+        {
+            if (juce::Time::getApproximateMillisecondCounter() > delayStartTime + 1000)
+                threadTask = ThreadTask::openSerialPort;
+        }
+        break;
+
+        case ThreadTask::closeSerialPort:
+        {
+            closeSerialPort ();
+            threadTask = ThreadTask::idle;
+        }
+        break;
+
+        case ThreadTask::processSerialPort:
+            return processSerialPort ();
+    }
+    return false;
+}
+
+bool SerialDevice::Controller::openSerialPort (void)
 {
     serialPort = std::make_unique<SerialPort> ([] (juce::String, juce::String) {});
     bool opened = serialPort->open (serialPortName);
@@ -82,7 +229,7 @@ bool SerialDevice::openSerialPort (void)
     {
         SerialPortConfig serialPortConfig;
         serialPort->getConfig (serialPortConfig);
-        serialPortConfig.bps = kBPS;
+        serialPortConfig.bps = kBootBPS;
         serialPortConfig.databits = 8;
         serialPortConfig.parity = SerialPortConfig::SERIALPORT_PARITY_NONE;
         serialPortConfig.stopbits = SerialPortConfig::STOPBITS_1;
@@ -90,8 +237,21 @@ bool SerialDevice::openSerialPort (void)
         
         serialPortInput = std::make_unique<SerialPortInputStream>(serialPort.get());
         serialPortOutput = std::make_unique<SerialPortOutputStream>(serialPort.get());
-        
-        juce::Logger::outputDebugString ("Serial port: " + serialPortName + " opened");
+
+        protocol = Protocol::ascii;
+        foundMessage = false;
+        packetLength = 0;
+        hasSequence = false;
+        holdX = holdY = pinched = false;
+        msPerByte = 0.0;
+        confirming = false;
+        droppedPackets = 0;
+        corruptedPackets = 0;
+        negotiating = true;
+        negotiationAttempts = 0;
+        requestBinaryStream ();
+
+        juce::Logger::outputDebugString ("Serial port: " + serialPortName + " opened (controller " + juce::String (id + 1) + ")");
     }
     else
     {
@@ -102,8 +262,9 @@ bool SerialDevice::openSerialPort (void)
     return opened;
 }
 
-void SerialDevice::closeSerialPort (void)
+void SerialDevice::Controller::closeSerialPort (void)
 {
+    isConnected = false;
     serialPortOutput = nullptr;
     serialPortInput = nullptr;
     if (serialPort != nullptr)
@@ -113,156 +274,257 @@ void SerialDevice::closeSerialPort (void)
     }
 }
 
+// Sends CONFIGURE: the baud rate and the packet rate the firmware should switch to
+void SerialDevice::Controller::requestBinaryStream (void)
+{
+    const uint8_t payload[6] { uint8_t (kStreamBPS), uint8_t (kStreamBPS >> 8), uint8_t (kStreamBPS >> 16), uint8_t (kStreamBPS >> 24),
+                               uint8_t (kStreamRateHz), uint8_t (kStreamRateHz >> 8) };
+    sendCommand (kCommandConfigure, payload, 6);
+
+    ++negotiationAttempts;
+    negotiationTime = juce::Time::getMillisecondCounterHiRes ();
+}
+
+// Sends CONFIRM at the new baud rate. The firmware keeps streaming only while these get through
+void SerialDevice::Controller::sendConfirm (void)
+{
+    sendCommand (kCommandConfirm, nullptr, 0);
+    lastConfirmSent = juce::Time::getMillisecondCounterHiRes ();
+}
+
+void SerialDevice::Controller::sendCommand (uint8_t command, const uint8_t* payload, int size)
+{
+    if (serialPortOutput == nullptr)
+        return;
+
+    uint8_t frame[4 + 8 + 2] { kStartByte1, kStartByte2, command, uint8_t (size) };
+    std::copy (payload, payload + size, frame + 4);
+    const uint16_t crc = crc16 (frame + 2, 2 + size);
+    frame[4 + size] = uint8_t (crc);
+    frame[5 + size] = uint8_t (crc >> 8);
+    serialPortOutput->write (frame, 4 + size + 2);
+}
+
+// Back to the rate the firmware boots at, where it sends ASCII lines
+void SerialDevice::Controller::fallBackToAscii (void)
+{
+    setBaudRate (kBootBPS);
+    protocol = Protocol::ascii;
+    confirming = false;
+    negotiating = false;
+    msPerByte = 0.0;
+    packetLength = 0;
+    juce::Logger::outputDebugString ("Serial port: " + serialPortName + " back to ASCII at " + juce::String (kBootBPS) + " bps");
+}
+
+void SerialDevice::Controller::setBaudRate (int bps)
+{
+    SerialPortConfig serialPortConfig;
+    serialPort->getConfig (serialPortConfig);
+    if (serialPortConfig.bps == static_cast<uint32_t> (bps))
+        return;
+    serialPortConfig.bps = bps;
+    serialPort->setConfig (serialPortConfig);
+}
+
 #define kSerialPortBufferLen 256
-void SerialDevice::run ()
-{   
-    Message m;
-    std::string number="";
-    const int kMaxCommandDataBytes = 4;
-    uint8_t commandData [kMaxCommandDataBytes];
-    uint8_t command = Command::none;
-    uint8_t commandDataSize = 0;
-    uint8_t commandDataCount = 0;
-    bool foundMessage = false;
-    while (!threadShouldExit ())
+bool SerialDevice::Controller::processSerialPort (void)
+{
+    const double now = juce::Time::getMillisecondCounterHiRes ();
+    isConnected = true;
+
+    // Restarts the port if the Arduino accidentally disconnects from the system
+    if (now > lastExistsCheck + kExistsCheckMs)
     {
-        switch (threadTask)
+        lastExistsCheck = now;
+        if (!serialPort->exists ())
         {
-            case ThreadTask::idle:
-            {
-                wait (1);
-                if (serialPortName.isNotEmpty ())
-                    threadTask = ThreadTask::openSerialPort;
-            }
-            break;
-            case ThreadTask::openSerialPort:
-            {
-                if (openSerialPort ())
-                {
-                    foundMessage = false;
-                    threadTask = ThreadTask::processSerialPort;
-                }
-                else
-                {
-                    threadTask = ThreadTask::delayBeforeOpening;
-                    delayStartTime = static_cast<uint64_t>(juce::Time::getMillisecondCounterHiRes ());
-                }
-            }
-            break;
+            closeSerialPort ();
+            threadTask = ThreadTask::openSerialPort;
+            return false;
+        }
+    }
 
-            case ThreadTask::delayBeforeOpening:
-            {
-                wait (1);
-                if (juce::Time::getApproximateMillisecondCounter() > delayStartTime + 1000)
-                    threadTask = ThreadTask::openSerialPort;
-            }
-            break;
+    // No answer to CONFIGURE: ask again, then settle for the ASCII lines
+    if (negotiating && now > negotiationTime + kNegotiationTimeoutMs)
+    {
+        if (negotiationAttempts < kNegotiationAttempts)
+            requestBinaryStream ();
+        else
+            negotiating = false;
+    }
 
-            case ThreadTask::closeSerialPort:
-            {
-                closeSerialPort ();
-                threadTask = ThreadTask::idle;
-            }
-            break;
+    // Either CONFIRM never got through, or the stream stopped: the firmware is back at kBootBPS
+    if (protocol == Protocol::binary)
+    {
+        if (confirming ? now > confirmStart + kConfirmTimeoutMs : now > lastPacketTime + kStreamTimeoutMs)
+            fallBackToAscii ();
+        else if (now > lastConfirmSent + kConfirmIntervalMs)
+            sendConfirm ();
+    }
 
-            case ThreadTask::processSerialPort:
-            {   
-                using namespace std::chrono;
-                openedAtLeastOnce = true;
-                isConnected = true;
-                
-                // handle reading from the serial port
-                if ((serialPortInput != nullptr) && (!serialPortInput->isExhausted ()))
-                {
-                    auto  bytesRead = 0;
-                    auto  dataIndex = 0;
-                    uint8_t incomingData [kSerialPortBufferLen];
-
-                    bytesRead = serialPortInput->read (incomingData, kSerialPortBufferLen);
-                    if (bytesRead < 1)
-                    {
-                        wait (1);
-                        continue;
-                    }
-                    else
-                    {
-                        // TODO: extract into function or class
-                        // parseIncomingData (incomingData, bytesRead);
-                        auto resetParser = [this, &command, &commandDataSize, &commandDataCount] ()
-                        {
-                            command = Command::none;
-                            commandDataSize = 0;
-                            commandDataCount = 0;
-                            parseState = ParseState::waitingForStartByte1;
-                        };
-                        // parse incoming data
-                        while (dataIndex < bytesRead)
-                        {
-
-                            const uint8_t dataByte = incomingData [dataIndex];
-                            // NOTE: the following line prints each byte received in the debug output window
-                            char character = (char)dataByte;
-                            
-                            //DBG(character);
-                            //juce::Logger::outputDebugString(character);
-                            std::string s = std::to_string(character);
-                            //juce::Logger::outputDebugString (s);
-                            //DBG(character);
-                            
-                            if (character == X_AXIS || character == Y_AXIS)
-                            {
-                                foundMessage = true;
-                                long time_start = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-                                m.direction = character;
-                            }
-                            if (character == PLUS_SIGN || character == MINUS_SIGN  && foundMessage)
-                            {
-                                m.verse = character;
-                            }
-                            if (character >= '0' && character <= '9' && foundMessage)
-                                number.push_back(character);
-                            if (character == '\r' && foundMessage) {
-                                
-                                if (number.empty())
-                                    m.value = 0;
-                                else {
-                                    m.value = stoi(number);
-                                }
-                                messages.push(m);
-                                number = "";
-                                /*DBG("AXIS:");
-                                DBG(m.direction);
-                                DBG("VERSE:");
-                                DBG(m.verse);
-                                DBG("VALUE");
-                                DBG(m.value);
-                                DBG("\n");*/
-                                long time_end = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-                                //DBG("TIME PASSED");
-                                //DBG(time_end - time_start);
-                                foundMessage = false;
-                            }
-                            
-                            ++dataIndex;
-                            
-                        }
-                    }
-                }
-            }
-            break;
-        }
+    // handle reading from the serial port
+    if ((serialPortInput == nullptr) || serialPortInput->isExhausted ())
+        return false;
+
+    uint8_t incomingData [kSerialPortBufferLen];
+
+    const auto bytesRead = serialPortInput->read (incomingData, kSerialPortBufferLen);
+    if (bytesRead < 1)
+        return false;
+
+    // Binary packets are recognised by their sync bytes and CRC, so the ASCII
+    // lines sent before the switch (calibration messages included) are skipped
+    const double readTime = juce::Time::getMillisecondCounterHiRes ();
+    for (int dataIndex = 0; dataIndex < bytesRead; ++dataIndex)
+    {
+        byteTime = readTime - (bytesRead - 1 - dataIndex) * msPerByte;
+        parseBinary (incomingData [dataIndex]);
+        if (protocol == Protocol::ascii)
+            parseAscii (incomingData [dataIndex]);
     }
+    return true;
 }
 
-// This function allow to restart the port if the Arduino accidentally disconnects from the system.
-void SerialDevice::timerCallback ()
-{   
-    if (serialPort != nullptr) {
-        if (serialPort->exists()) {
-        }
+// ASCII lines: axis character, sign, value from 0 to 100, "\r\n"
+void SerialDevice::Controller::parseAscii (uint8_t dataByte)
+{
+    const char character = (char) dataByte;
+
+    if (character == X_AXIS || character == Y_AXIS)
+    {
+        foundMessage = true;
+        asciiMessage.direction = character;
+    }
+    if (character == PLUS_SIGN || character == MINUS_SIGN  && foundMessage)
+    {
+        asciiMessage.verse = character;
+    }
+    if (character >= '0' && character <= '9' && foundMessage)
+        asciiNumber.push_back(character);
+    if (character == '\r' && foundMessage) {
+
+        if (asciiNumber.empty())
+            asciiMessage.value = 0;
         else {
-            closeSerialPort();
-            threadTask = ThreadTask::openSerialPort;
+            asciiMessage.value = stoi(asciiNumber);
         }
+        asciiMessage.time = byteTime;
+        if (onMessage != nullptr)
+            onMessage(asciiMessage);
+        asciiNumber = "";
+        foundMessage = false;
+    }
+}
+
+// Collects packetSize bytes starting with the sync bytes, then checks the CRC.
+// On a bad CRC the parser looks for the next sync bytes inside the rejected packet.
+void SerialDevice::Controller::parseBinary (uint8_t dataByte)
+{
+    if (packetLength == 0 && dataByte != kPacketSync1)
+        return;
+    if (packetLength == 1 && dataByte != kPacketSync2)
+    {
+        packetLength = (dataByte == kPacketSync1) ? 1 : 0;
+        return;
+    }
+
+    packet[static_cast<size_t> (packetLength++)] = dataByte;
+    if (packetLength < packetSize)
+        return;
+
+    packetLength = 0;
+    if (crc16 (packet.data () + 2, packetSize - 4) == readUint16 (packet.data () + packetSize - 2))
+    {
+        handlePacket ();
+        return;
+    }
+
+    ++corruptedPackets;
+    for (int start = 1; start < packetSize; ++start)
+    {
+        if (packet[static_cast<size_t> (start)] != kPacketSync1)
+            continue;
+        const std::array<uint8_t, packetSize> rejected = packet;
+        for (int i = start; i < packetSize; ++i)
+            parseBinary (rejected[static_cast<size_t> (i)]);
+        return;
+    }
+}
+
+void SerialDevice::Controller::handlePacket (void)
+{
+    const uint8_t type = packet[2];
+    const uint16_t sequence = readUint16 (packet.data () + 4);
+
+    if (type == kPacketAck)
+    {
+        // The firmware switches to the accepted baud rate right after the ACK,
+        // and waits for CONFIRM at that rate
+        const int bps = readUint16 (packet.data () + 6) | (readUint16 (packet.data () + 8) << 16);
+        const int rateHz = readUint16 (packet.data () + 12);
+        setBaudRate (bps);
+        msPerByte = rateHz > 0 ? 1000.0 / (rateHz * packetSize) : 0.0;
+        negotiating = false;
+        protocol = Protocol::binary;
+        hasSequence = false;
+        confirming = true;
+        confirmStart = juce::Time::getMillisecondCounterHiRes ();
+        lastPacketTime = confirmStart;
+        sendConfirm ();
+        juce::Logger::outputDebugString ("Serial port: binary stream at " + juce::String (bps) + " bps, "
+                                         + juce::String (rateHz) + " Hz");
+        return;
+    }
+    if (type != kPacketSample)
+        return;
+
+    protocol = Protocol::binary;
+    lastPacketTime = juce::Time::getMillisecondCounterHiRes ();
+    if ((packet[3] & kPacketFlagConfirmed) != 0)
+        confirming = false;
+    if (hasSequence)
+        droppedPackets += static_cast<uint16_t> (sequence - lastSequence - 1);
+    hasSequence = true;
+    lastSequence = sequence;
+
+    const int x = static_cast<int16_t> (readUint16 (packet.data () + 6));
+    const int y = static_cast<int16_t> (readUint16 (packet.data () + 8));
+    const int z = static_cast<int16_t> (readUint16 (packet.data () + 10));
+    const bool pinch = (packet[3] & kPacketFlagPinch) != 0;
+
+    // Same gesture as the ASCII firmware: the most tilted axis, once past the threshold,
+    // moves its parameter; pinching while tilting holds that parameter or releases it
+    const bool alongX = std::abs (x) > std::abs (y);
+    const int delta = alongX ? x : y;
+    const bool tilted = std::abs (delta) > kTiltMin;
+
+    if (pinch && !pinched && tilted)
+    {
+        if (alongX)
+            holdX = !holdX;
+        else
+            holdY = !holdY;
     }
-}
\ No newline at end of file
+    pinched = pinch;
+
+    if (tilted && !(alongX ? holdX : holdY))
+        emit (alongX ? X_AXIS : Y_AXIS, delta);
+
+    // Z moves away from rest whichever way the controller is tilted or lifted, so it is
+    // sent on its own, not in competition with X and Y
+    if (std::abs (z) > kTiltMin)
+        emit (Z_AXIS, z);
+}
+
+void SerialDevice::Controller::emit (char direction, int delta)
+{
+    Message message;
+    message.direction = direction;
+    message.verse = delta > 0 ? PLUS_SIGN : MINUS_SIGN;
+    message.value = tiltToValue (delta);
+    message.controller = id;
+    message.time = byteTime;
+    if (onMessage != nullptr)
+        onMessage (message);
+}
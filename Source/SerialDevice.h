@@ -1,29 +1,45 @@
 /*
-* Definition of the class that implements the interconnection between JUCE and Arduino. 
+* Definition of the class that implements the interconnection between JUCE and Arduino.
 * It inherits the juce::Thread class as it works as a separate background thread.
+*
+* Several controllers can be connected at once, one serial port each. A single thread
+* services all of them: every controller has its own port, protocol negotiation and
+* parser state, and the messages it produces carry its index as controller ID.
 */
 
 
 #pragma once
 
 #include <JuceHeader.h>
-#include <stack>
+#include <functional>
 #include "Message.h"
 
-// This class implements the interconnection between JUCE and Arduino. 
+// This class implements the interconnection between JUCE and Arduino.
 // It inherits the juce::Thread class as it works as a separate background thread
-class SerialDevice : private juce::Thread, private juce::Timer
+class SerialDevice : private juce::Thread
 {
 public:
-    SerialDevice ();
+    static constexpr int maxControllers = 4;
+
+    // onMessage is called on the serial thread for every message received from Arduino,
+    // with Message::controller set to the index of the port it came from.
+    explicit SerialDevice (std::function<void (const Message&)> onMessage);
     ~SerialDevice ();
     void open (void);
     void close (void);
-    void init (juce::String newSerialPortName);
 
-    //Data structure used to store all the data coming from Arduino, in form of objects of type Message. See Message.h.
-    std::stack<Message> messages;
-    bool isConnected = false;
+    // One port per controller, in controller ID order. Only the first maxControllers are used.
+    void init (const juce::StringArray& newSerialPortNames);
+
+    int getNumControllers () const { return numControllers; }
+    bool isConnected (int controller) const;
+    bool isAnyConnected () const;
+
+    // Binary packets lost (sequence gaps) or rejected (bad CRC) since the port was opened
+    uint32_t getDroppedPackets (int controller) const;
+    uint32_t getCorruptedPackets (int controller) const;
+
+    static constexpr int packetSize = 16;
 private:
     enum class ThreadTask
     {
@@ -34,20 +50,103 @@ private:
         processSerialPort,
     };
 
-    bool openedAtLeastOnce{ false };
+    // The firmware starts with ASCII lines. requestBinaryStream() asks it for binary
+    // packets at a higher baud rate; firmware that doesn't answer stays on ASCII.
+    enum class Protocol
+    {
+        ascii,
+        binary
+    };
+
+    // Port and parser state of one controller. Only the serial thread touches it,
+    // except for the atomics.
+    class Controller
+    {
+    public:
+        Controller (int id, const juce::String& portName, const std::function<void (const Message&)>& onMessage);
+        ~Controller ();
+
+        // Runs one step of the task of this controller.
+        // Returns true if bytes were read, false if there was nothing to do.
+        bool service (void);
+        // True while the port is closed and the thread only needs to check it now and then
+        bool isWaiting (void) const;
+
+        std::atomic<ThreadTask> threadTask { ThreadTask::idle };
+        std::atomic<bool> isConnected { false };
+        std::atomic<uint32_t> droppedPackets { 0 };
+        std::atomic<uint32_t> corruptedPackets { 0 };
+
+    private:
+        const int id;
+        const juce::String serialPortName;
+        const std::function<void (const Message&)>& onMessage;
+
+        std::unique_ptr<SerialPort> serialPort;
+        std::unique_ptr<SerialPortInputStream> serialPortInput;
+        std::unique_ptr<SerialPortOutputStream> serialPortOutput;
+        uint64_t delayStartTime { 0 };
+        double lastExistsCheck { 0.0 };
+
+        bool openSerialPort (void);
+        void closeSerialPort (void);
+        bool processSerialPort (void);
+
+        Protocol protocol { Protocol::ascii };
+        bool negotiating { false };
+        int negotiationAttempts { 0 };
+        double negotiationTime { 0.0 };
+
+        // After the ACK both sides run at the new baud rate. The firmware keeps it only while
+        // CONFIRM keeps arriving, and flags its packets once it got one. If the ACK, CONFIRM or
+        // the stream is lost, each side goes back to kBootBPS and the ASCII lines on its own.
+        bool confirming { false };
+        double confirmStart { 0.0 };
+        double lastConfirmSent { 0.0 };
+        double lastPacketTime { 0.0 };
+
+        void requestBinaryStream (void);
+        void sendConfirm (void);
+        void sendCommand (uint8_t command, const uint8_t* payload, int size);
+        void fallBackToAscii (void);
+        void setBaudRate (int bps);
+
+        // Time of the byte being parsed. The bytes of one read arrive together, so in binary
+        // mode they are spread back over the packet period, from the time of the read.
+        double byteTime { 0.0 };
+        double msPerByte { 0.0 };
+
+        // ASCII parser state
+        Message asciiMessage;
+        std::string asciiNumber;
+        bool foundMessage { false };
+
+        void parseAscii (uint8_t dataByte);
+
+        // Binary parser state
+        std::array<uint8_t, packetSize> packet;
+        int packetLength { 0 };
+        bool hasSequence { false };
+        uint16_t lastSequence { 0 };
+
+        // A pinch while tilting holds the parameter of that axis, as the ASCII firmware does
+        bool holdX { false }, holdY { false };
+        bool pinched { false };
+
+        void parseBinary (uint8_t dataByte);
+        void handlePacket (void);
+        void emit (char direction, int delta);
+    };
 
-    juce::String serialPortName;
-    std::unique_ptr<SerialPort> serialPort;
-    std::unique_ptr<SerialPortInputStream> serialPortInput;
-    std::unique_ptr<SerialPortOutputStream> serialPortOutput;
-    ThreadTask threadTask { ThreadTask::idle };
-    uint64_t delayStartTime { 0 };
+    //Receives all the data coming from Arduino, in form of objects of type Message. See Message.h.
+    std::function<void (const Message&)> onMessage;
 
-    bool openSerialPort (void);
-    void closeSerialPort (void);
+    std::array<std::unique_ptr<Controller>, maxControllers> controllers;
+    std::atomic<int> numControllers { 0 };
 
     //This is where the magic happens. This function is responsible for acquiring data bytes
-    //from Arduino serial port, and parsing them to create the Message objects used by the JUCE processing
+    //from the Arduino serial ports, and parsing them to create the Message objects used by the JUCE processing.
+    //The streams of juce_serialport are read without blocking, so the thread goes through all
+    //the controllers in turn and only sleeps when none of them had data.
     void run () override;
-    void timerCallback () override;
-};
\ No newline at end of file
+};
@@ -0,0 +1,143 @@
+/*
+* Spectrum analyser of the editor. The editor timer passes the frames published by the
+* FFTProcessor with setFrame(). The bins are decimated to one value per pixel column, on
+* a log frequency axis: the bins of each column are computed once, when the size or the
+* FFT resolution changes. Only the columns that moved are repainted.
+*/
+#pragma once
+
+#include <JuceHeader.h>
+#include "FFTProcessor.h"
+
+class SpectrumDisplay : public juce::Component {
+public:
+    void setFrame(const FFTProcessor::Frame& frame) {
+        if (frame.numBins < 2 || columnLevels.empty())
+            return;
+
+        if (frame.numBins != mappedNumBins || frame.sampleRate != mappedSampleRate)
+            mapColumns(frame.numBins, frame.sampleRate);
+
+        // A full scale sine through the Hann window has a magnitude of fftSize / 4
+        const float normalisation = 4.0f / float(2 * (frame.numBins - 1));
+
+        int dirtyStart = -1, dirtyEnd = -1;
+        int dirtyTop = getHeight(), dirtyBottom = 0;
+
+        for (int column = 0; column < int(columnLevels.size()); ++column) {
+            const auto& bins = columnBins[column];
+            float magnitude = 0.0f;
+            for (int bin = bins.getStart(); bin < bins.getEnd(); ++bin)
+                magnitude = juce::jmax(magnitude, frame.magnitudes[bin]);
+
+            // Fast attack, slow fall, so the bars don't flicker
+            const float db = juce::Decibels::gainToDecibels(magnitude * normalisation, minDb);
+            const float level = juce::jmax(db, columnLevels[column] - fallDbPerFrame);
+
+            const int oldY = levelToY(columnLevels[column]);
+            const int newY = levelToY(level);
+            columnLevels[column] = level;
+
+            if (oldY != newY) {
+                if (dirtyStart < 0)
+                    dirtyStart = column;
+                dirtyEnd = column + 1;
+                dirtyTop = juce::jmin(dirtyTop, oldY, newY);
+                dirtyBottom = getHeight();
+            }
+        }
+
+        if (dirtyStart >= 0)
+            repaint(dirtyStart, dirtyTop, dirtyEnd - dirtyStart, dirtyBottom - dirtyTop);
+    }
+
+    void paint(juce::Graphics& g) override {
+        const auto clip = g.getClipBounds();
+
+        g.setColour(backgroundColor);
+        g.fillRect(clip);
+
+        g.setColour(gridColor);
+        g.strokePath(grid, juce::PathStrokeType(1.0f));
+
+        // Only the columns inside the dirty region
+        g.setColour(spectrumColor);
+        const int end = juce::jmin(clip.getRight(), int(columnLevels.size()));
+        for (int column = juce::jmax(0, clip.getX()); column < end; ++column) {
+            const int y = levelToY(columnLevels[column]);
+            g.fillRect(column, y, 1, getHeight() - y);
+        }
+
+        g.setColour(textColor);
+        g.setFont(10.0f);
+        for (const auto& label : gridLabels)
+            if (clip.intersects(label.second))
+                g.drawText(label.first, label.second, juce::Justification::centredLeft);
+    }
+
+    void resized() override {
+        columnLevels.assign(static_cast<size_t>(juce::jmax(0, getWidth())), minDb);
+        columnBins.assign(columnLevels.size(), {});
+        mappedNumBins = 0;
+
+        // Frequency and level grid, built once per size
+        grid.clear();
+        gridLabels.clear();
+        for (float frequency : { 50.0f, 100.0f, 200.0f, 500.0f, 1000.0f, 2000.0f, 5000.0f, 10000.0f }) {
+            const float x = std::round(frequencyToX(frequency)) + 0.5f;
+            grid.addLineSegment({ x, 0.0f, x, float(getHeight()) }, 1.0f);
+            gridLabels.push_back({ frequency >= 1000.0f ? juce::String(int(frequency / 1000.0f)) + "k" : juce::String(int(frequency)),
+                                   juce::Rectangle<int>(int(x) + 2, getHeight() - 14, 30, 12) });
+        }
+        for (float db = -20.0f; db > minDb; db -= 20.0f) {
+            const float y = float(levelToY(db)) + 0.5f;
+            grid.addLineSegment({ 0.0f, y, float(getWidth()), y }, 1.0f);
+        }
+    }
+
+private:
+    static constexpr float minDb = -100.0f;
+    static constexpr float minFrequency = 20.0f;
+    static constexpr float maxFrequency = 20000.0f;
+    static constexpr float fallDbPerFrame = 1.5f;
+
+    // Level and bin range [start, end) of each pixel column
+    std::vector<float> columnLevels;
+    std::vector<juce::Range<int>> columnBins;
+    int mappedNumBins = 0;
+    double mappedSampleRate = 0.0;
+
+    juce::Path grid;
+    std::vector<std::pair<juce::String, juce::Rectangle<int>>> gridLabels;
+
+    juce::Colour backgroundColor{ juce::Colour(20, 20, 20) };
+    juce::Colour gridColor{ juce::Colour(50, 50, 50) };
+    juce::Colour spectrumColor{ juce::Colour(5, 73, 229) };
+    juce::Colour textColor{ juce::Colour(160, 160, 160) };
+
+    float frequencyToX(float frequency) const {
+        return getWidth() * std::log(frequency / minFrequency) / std::log(maxFrequency / minFrequency);
+    }
+
+    float xToFrequency(float x) const {
+        return minFrequency * std::pow(maxFrequency / minFrequency, x / float(getWidth()));
+    }
+
+    int levelToY(float db) const {
+        return juce::roundToInt(getHeight() * juce::jlimit(0.0f, 1.0f, db / minDb));
+    }
+
+    // Each column takes the largest magnitude among its bins. At low frequencies a column
+    // is narrower than a bin and just takes the nearest one.
+    void mapColumns(int numBins, double sampleRate) {
+        mappedNumBins = numBins;
+        mappedSampleRate = sampleRate;
+
+        const float binWidth = float(sampleRate) / float(2 * (numBins - 1));
+        for (int column = 0; column < int(columnBins.size()); ++column) {
+            const int first = juce::jlimit(0, numBins - 1, juce::roundToInt(xToFrequency(float(column)) / binWidth));
+            const int last = juce::jlimit(first + 1, numBins, juce::roundToInt(xToFrequency(float(column + 1)) / binWidth));
+            columnBins[column] = { first, last };
+        }
+    }
+};
@@ -0,0 +1,81 @@
+/*
+  This class switches an effect stage on and off without clicks. While the stage is
+  off its DSP is skipped entirely and the signal passes through untouched. When it is
+  switched on or off the processed and the unprocessed signals are crossfaded over
+  fadeSeconds. Each stage in EQAudioProcessor::processBlock() is wrapped like this:
+
+      if (stage.begin(shouldProcess, block)) {
+          ...process block...
+          stage.end(block);
+      }
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class StageBypass
+{
+public:
+    void prepare(double sampleRate, int maxBlockSize, int numChannels)
+    {
+        dryBuffer.setSize(numChannels, maxBlockSize);
+        ramp.allocate(static_cast<size_t>(maxBlockSize), true);
+
+        mix.reset(sampleRate, fadeSeconds);
+        mix.setCurrentAndTargetValue(mix.getTargetValue());
+    }
+
+    // Returns true if the stage has to process this block, i.e. if it is active or fading.
+    // The block must not be longer than getMaxBlockSize().
+    bool begin(bool shouldBeActive, const juce::dsp::AudioBlock<float>& block)
+    {
+        jassert(static_cast<int>(block.getNumSamples()) <= getMaxBlockSize());
+        mix.setTargetValue(shouldBeActive ? 1.0f : 0.0f);
+
+        fading = mix.isSmoothing();
+        processing = fading || mix.getCurrentValue() > 0.0f;
+
+        if (fading) {
+            const int numSamples = static_cast<int>(block.getNumSamples());
+            for (int channel = 0; channel < dryBuffer.getNumChannels() && channel < static_cast<int>(block.getNumChannels()); ++channel)
+                dryBuffer.copyFrom(channel, 0, block.getChannelPointer(static_cast<size_t>(channel)), numSamples);
+        }
+        return processing;
+    }
+
+    // Crossfades the processed block with the signal saved by begin(), if a fade is running.
+    void end(juce::dsp::AudioBlock<float>& block)
+    {
+        if (!fading)
+            return;
+
+        const int numSamples = static_cast<int>(block.getNumSamples());
+        for (int i = 0; i < numSamples; ++i)
+            ramp[i] = mix.getNextValue();
+
+        // out = dry + mix * (wet - dry)
+        for (int channel = 0; channel < dryBuffer.getNumChannels() && channel < static_cast<int>(block.getNumChannels()); ++channel) {
+            float* wet = block.getChannelPointer(static_cast<size_t>(channel));
+            const float* dry = dryBuffer.getReadPointer(channel);
+            juce::FloatVectorOperations::subtract(wet, dry, numSamples);
+            juce::FloatVectorOperations::multiply(wet, ramp.get(), numSamples);
+            juce::FloatVectorOperations::add(wet, dry, numSamples);
+        }
+    }
+
+    int getMaxBlockSize() const { return dryBuffer.getNumSamples(); }
+
+    // True if the stage ran its DSP in the last block. Can be read from any thread, for profiling.
+    bool isProcessing() const { return processing; }
+
+private:
+    static constexpr double fadeSeconds = 0.01;
+
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Linear> mix{ 1.0f };
+    juce::AudioBuffer<float> dryBuffer;
+    juce::HeapBlock<float> ramp;
+
+    bool fading = false;
+    std::atomic<bool> processing{ true };
+};